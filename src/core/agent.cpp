@@ -0,0 +1,265 @@
+#include "agent.h"
+#include "functions.h"
+#include "progress.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+// wire format, all integers little endian uint32:
+//   request:  "SFMA" | version | argc | (len | bytes) * argc   -- args[0] is the client's cwd
+//   response: status | len | output bytes
+static const char AGENT_MAGIC[4] = {'S', 'F', 'M', 'A'};
+#define AGENT_PROTOCOL_VERSION 1
+
+std::string agentSocketPath() {
+    const char* path = std::getenv("SFM_AGENT_SOCK");
+    if (path && *path) return path;
+    return getSFMDirectory() + "/" + AGENT_SOCKET_NAME;
+}
+
+#ifndef _WIN32
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+    stopRequested = 1;
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = ::recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool writeU32(int fd, uint32_t value) {
+    return writeAll(fd, &value, sizeof(value));
+}
+
+static bool readU32(int fd, uint32_t& value) {
+    return readAll(fd, &value, sizeof(value));
+}
+
+static bool fillAddress(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static int connectTo(const std::string& path) {
+    sockaddr_un addr;
+    if (!fillAddress(path, addr)) return -1;
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sameUser(int fd) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+    return cred.uid == ::getuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (::getpeereid(fd, &uid, &gid) != 0) return false;
+    return uid == ::getuid();
+#endif
+}
+
+static bool readRequest(int fd, std::vector<std::string>& args) {
+    char magic[4];
+    uint32_t version, count;
+    if (!readAll(fd, magic, 4) || std::memcmp(magic, AGENT_MAGIC, 4) != 0) return false;
+    if (!readU32(fd, version) || version != AGENT_PROTOCOL_VERSION) return false;
+    if (!readU32(fd, count) || count == 0 || count > AGENT_MAX_ARGS) return false;
+
+    args.resize(count);
+    for (auto& arg : args) {
+        uint32_t len;
+        if (!readU32(fd, len) || len > AGENT_MAX_ARG_SIZE) return false;
+        arg.resize(len);
+        if (len > 0 && !readAll(fd, &arg[0], len)) return false;
+    }
+    return true;
+}
+
+static void serve(int fd, const AgentHandler& handler) {
+    // requests are served one after the other, a client that stalls must not hold up the rest
+    timeval timeout = {10, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::vector<std::string> args;
+    if (!sameUser(fd) || !readRequest(fd, args)) return;
+
+    LockedStringBuf captured;
+    int status = 1;
+    std::error_code ec;
+    std::filesystem::current_path(args[0], ec);
+    if (ec) {
+        captured.text = "[Error] Agent cannot enter " + args[0] + "\n";
+    } else {
+        std::streambuf* oldOut = std::cout.rdbuf(&captured);
+        std::streambuf* oldErr = std::cerr.rdbuf(&captured);
+        try {
+            status = handler(std::vector<std::string>(args.begin() + 1, args.end()));
+        } catch (const std::exception& e) {
+            std::cerr << "[Error] " << e.what() << "\n";
+        }
+        std::cout.rdbuf(oldOut);
+        std::cerr.rdbuf(oldErr);
+    }
+
+    if (!writeU32(fd, static_cast<uint32_t>(status)) || !writeU32(fd, static_cast<uint32_t>(captured.text.size()))) return;
+    writeAll(fd, captured.text.data(), captured.text.size()); // nothing to do if the client went away
+}
+
+bool runAgent(const std::string& socketPath, int idleSeconds, const AgentHandler& handler) {
+    sockaddr_un addr;
+    if (!fillAddress(socketPath, addr)) {
+        std::cerr << "[Error] Socket path is too long: " << socketPath << "\n";
+        return false;
+    }
+
+    // a socket nobody answers on is left over from an agent that died
+    int probe = connectTo(socketPath);
+    if (probe >= 0) {
+        ::close(probe);
+        std::cerr << "[Error] An agent is already running on " << socketPath << "\n";
+        return false;
+    }
+    ::unlink(socketPath.c_str());
+
+    int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) return false;
+    mode_t oldMask = ::umask(0177); // the socket is created 0600
+    int rc = ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    ::umask(oldMask);
+    if (rc != 0 || ::listen(listener, 16) != 0) {
+        std::cerr << "[Error] Cannot listen on " << socketPath << ": " << std::strerror(errno) << "\n";
+        ::close(listener);
+        return false;
+    }
+
+#ifdef __linux__
+    // no core dumps and no ptrace from other processes of this user while the keys are held
+    ::prctl(PR_SET_DUMPABLE, 0);
+#endif
+    stopRequested = 0;
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "[Core] Agent listening on " << socketPath << ", exits after " << idleSeconds << " s idle.\n";
+    const std::chrono::seconds idle(idleSeconds);
+    auto deadline = std::chrono::steady_clock::now() + idle;
+    while (!stopRequested) {
+        int64_t left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) break; // idle timeout
+
+        // poll takes an int of milliseconds, a longer timeout is waited out in several calls
+        pollfd pfd = {listener, POLLIN, 0};
+        int ready = ::poll(&pfd, 1, static_cast<int>(std::min<int64_t>(left, INT_MAX)));
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0) break;
+        if (ready == 0) continue;
+
+        int client = ::accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        serve(client, handler);
+        ::close(client);
+        deadline = std::chrono::steady_clock::now() + idle;
+    }
+
+    ::close(listener);
+    ::unlink(socketPath.c_str());
+    std::cout << "[Core] Agent stopped.\n";
+    return true;
+}
+
+AgentCall callAgent(const std::string& socketPath, const std::vector<std::string>& args, std::string& output, int& status) {
+    int fd = connectTo(socketPath);
+    if (fd < 0) return AgentCall::NOT_SENT;
+
+    std::error_code ec;
+    std::string cwd = std::filesystem::current_path(ec).string();
+
+    bool ok = writeAll(fd, AGENT_MAGIC, 4) && writeU32(fd, AGENT_PROTOCOL_VERSION) &&
+              writeU32(fd, static_cast<uint32_t>(args.size() + 1)) &&
+              writeU32(fd, static_cast<uint32_t>(cwd.size())) && writeAll(fd, cwd.data(), cwd.size());
+    for (size_t i = 0; ok && i < args.size(); i++) {
+        ok = writeU32(fd, static_cast<uint32_t>(args[i].size())) && writeAll(fd, args[i].data(), args[i].size());
+    }
+    if (!ok) {
+        // the agent only runs a request it has read to the end
+        ::close(fd);
+        return AgentCall::NOT_SENT;
+    }
+
+    uint32_t code = 1, len = 0;
+    ok = readU32(fd, code) && readU32(fd, len);
+    if (ok) {
+        output.resize(len);
+        ok = (len == 0) || readAll(fd, &output[0], len);
+    }
+    ::close(fd);
+    status = static_cast<int>(code);
+    return ok ? AgentCall::DONE : AgentCall::LOST;
+}
+
+#else
+
+bool runAgent(const std::string&, int, const AgentHandler&) {
+    std::cerr << "[Error] The agent needs Unix sockets, it is not available on Windows.\n";
+    return false;
+}
+
+AgentCall callAgent(const std::string&, const std::vector<std::string>&, std::string&, int&) {
+    return AgentCall::NOT_SENT;
+}
+
+#endif
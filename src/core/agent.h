@@ -0,0 +1,34 @@
+#ifndef AGENT_H
+#define AGENT_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define AGENT_SOCKET_NAME "agent.sock"
+#define AGENT_DEFAULT_IDLE_SECONDS 900
+#define AGENT_MAX_ARG_SIZE (64 * 1024)
+#define AGENT_MAX_ARGS 256
+
+// args of one request, without the client's working directory. Whatever the handler prints to
+// std::cout / std::cerr goes back to the client, the return value is the client's exit code
+typedef std::function<int(const std::vector<std::string>& args)> AgentHandler;
+
+std::string agentSocketPath(); // $SFM_AGENT_SOCK, otherwise ~/.sfm/agent.sock
+
+// Serves requests over a Unix socket, one at a time, until nothing has arrived for idleSeconds
+// or the process gets SIGINT / SIGTERM. Only connections from the same user are accepted, and
+// each request runs in the client's working directory.
+bool runAgent(const std::string& socketPath, int idleSeconds, const AgentHandler& handler);
+
+enum class AgentCall : uint8_t {
+    DONE,     // output and status are the agent's
+    NOT_SENT, // no agent listening, or it went away before it had the whole request: nothing ran
+    LOST      // the request was sent but no answer came back, the command may or may not have run
+};
+
+// only NOT_SENT lets the caller do the work itself, anything else could run a command twice
+AgentCall callAgent(const std::string& socketPath, const std::vector<std::string>& args, std::string& output, int& status);
+
+#endif
@@ -0,0 +1,144 @@
+#include "allocator.h"
+#include <cstring>
+#include <iterator>
+
+ExtentAllocator::ExtentAllocator()
+    : dataStart(0), blockCount(0), blockSize(4096), freeBlocks(0), dirtyFirst(UINT64_MAX), dirtyLast(0) { }
+
+void ExtentAllocator::reset(uint64_t start, uint64_t blocks, uint32_t size) {
+    dataStart = start;
+    blockCount = blocks;
+    blockSize = size;
+    freeBlocks = 0;
+    byOffset.clear();
+    bySize.clear();
+    bits.assign((blocks + 7) / 8, 0);
+    dirtyFirst = UINT64_MAX;
+    dirtyLast = 0;
+    if (blocks > 0) addFree(0, blocks);
+}
+
+void ExtentAllocator::loadBitmap(const std::vector<uint8_t>& bitmap) {
+    reset(dataStart, blockCount, blockSize);
+    if (bitmap.size() < bits.size()) return;
+    std::memcpy(bits.data(), bitmap.data(), bits.size());
+
+    byOffset.clear();
+    bySize.clear();
+    freeBlocks = 0;
+
+    uint64_t runStart = 0;
+    bool inRun = false;
+    for (uint64_t b = 0; b < blockCount; b++) {
+        bool used = (bits[b / 8] >> (b % 8)) & 1;
+        if (!used && !inRun) {
+            runStart = b;
+            inRun = true;
+        } else if (used && inRun) {
+            addFree(runStart, b - runStart);
+            inRun = false;
+        }
+    }
+    if (inRun) addFree(runStart, blockCount - runStart);
+}
+
+void ExtentAllocator::addFree(uint64_t first, uint64_t count) {
+    // merge with the neighbours on both sides
+    auto next = byOffset.lower_bound(first);
+    if (next != byOffset.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == first) {
+            first = prev->first;
+            count += prev->second;
+            freeBlocks -= prev->second;
+            bySize.erase({prev->second, prev->first});
+            byOffset.erase(prev);
+        }
+    }
+    if (next != byOffset.end() && first + count == next->first) {
+        count += next->second;
+        freeBlocks -= next->second;
+        bySize.erase({next->second, next->first});
+        byOffset.erase(next);
+    }
+    byOffset[first] = count;
+    bySize.insert({count, first});
+    freeBlocks += count;
+}
+
+void ExtentAllocator::takeFree(uint64_t first, uint64_t count, uint64_t used) {
+    byOffset.erase(first);
+    bySize.erase({count, first});
+    freeBlocks -= count;
+    if (used < count) {
+        byOffset[first + used] = count - used;
+        bySize.insert({count - used, first + used});
+        freeBlocks += count - used;
+    }
+    mark(first, used, true);
+}
+
+void ExtentAllocator::mark(uint64_t first, uint64_t count, bool used) {
+    for (uint64_t b = first; b < first + count; b++) {
+        if (used) bits[b / 8] |= static_cast<uint8_t>(1u << (b % 8));
+        else bits[b / 8] &= static_cast<uint8_t>(~(1u << (b % 8)));
+    }
+    if (count == 0) return;
+    if (first / 8 < dirtyFirst) dirtyFirst = first / 8;
+    if ((first + count - 1) / 8 > dirtyLast) dirtyLast = (first + count - 1) / 8;
+}
+
+bool ExtentAllocator::allocateContiguous(uint64_t bytes, Extent& out) {
+    uint64_t need = blocksFor(bytes);
+    if (need == 0) need = 1;
+
+    auto it = bySize.lower_bound({need, 0});
+    if (it == bySize.end()) return false;
+
+    uint64_t first = it->second;
+    takeFree(first, it->first, need);
+    out.offset = dataStart + first * blockSize;
+    out.length = need * blockSize;
+    return true;
+}
+
+bool ExtentAllocator::allocate(uint64_t bytes, std::vector<Extent>& out) {
+    uint64_t need = blocksFor(bytes);
+    if (need == 0) return true;
+    if (need > freeBlocks) return false;
+
+    Extent single;
+    if (allocateContiguous(bytes, single)) {
+        out.push_back(single);
+        return true;
+    }
+
+    // fragmented: fill from the largest holes so the file gets as few extents as possible
+    while (need > 0) {
+        auto largest = std::prev(bySize.end());
+        uint64_t count = largest->first;
+        uint64_t first = largest->second;
+        uint64_t used = (count < need) ? count : need;
+        takeFree(first, count, used);
+        out.push_back({dataStart + first * blockSize, used * blockSize});
+        need -= used;
+    }
+    return true;
+}
+
+void ExtentAllocator::release(const Extent& extent) {
+    if (extent.length == 0) return;
+    uint64_t first = (extent.offset - dataStart) / blockSize;
+    uint64_t count = blocksFor(extent.length);
+    mark(first, count, false);
+    addFree(first, count);
+}
+
+bool ExtentAllocator::takeDirty(uint64_t& first, uint64_t& last) {
+    if (dirtyFirst == UINT64_MAX) return false;
+    first = dirtyFirst;
+    last = dirtyLast;
+    dirtyFirst = UINT64_MAX;
+    dirtyLast = 0;
+    return true;
+}
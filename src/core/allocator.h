@@ -0,0 +1,55 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+struct Extent {
+    uint64_t offset; // bytes, inside the vault's plaintext space
+    uint64_t length; // bytes, a multiple of the block size
+};
+
+// Free space as a set of extents: by offset for coalescing, by size for best-fit.
+// The on-disk truth is a bitmap (one bit per block, set = used) that the free extents
+// are rebuilt from on open; every change marks the touched bitmap bytes dirty.
+class ExtentAllocator {
+public:
+    ExtentAllocator();
+
+    void reset(uint64_t dataStart, uint64_t blockCount, uint32_t blockSize);
+    void loadBitmap(const std::vector<uint8_t>& bitmap);
+
+    // one extent if a big enough hole exists, otherwise the largest holes first
+    bool allocate(uint64_t bytes, std::vector<Extent>& out);
+    bool allocateContiguous(uint64_t bytes, Extent& out);
+    void release(const Extent& extent);
+
+    uint64_t freeBytes() const { return freeBlocks * blockSize; }
+    uint32_t getBlockSize() const { return blockSize; }
+    const std::vector<uint8_t>& bitmap() const { return bits; }
+    uint64_t bitmapBytes() const { return bits.size(); }
+
+    // bitmap byte range [first, last] changed since the last call, false when clean
+    bool takeDirty(uint64_t& first, uint64_t& last);
+
+private:
+    uint64_t dataStart;
+    uint64_t blockCount;
+    uint32_t blockSize;
+    uint64_t freeBlocks;
+    std::map<uint64_t, uint64_t> byOffset;          // first block -> block count
+    std::set<std::pair<uint64_t, uint64_t>> bySize; // (block count, first block)
+    std::vector<uint8_t> bits;
+    uint64_t dirtyFirst;
+    uint64_t dirtyLast;
+
+    void addFree(uint64_t first, uint64_t count);
+    void takeFree(uint64_t first, uint64_t count, uint64_t used); // use the first `used` blocks of a hole
+    void mark(uint64_t first, uint64_t count, bool used);
+    uint64_t blocksFor(uint64_t bytes) const { return (bytes + blockSize - 1) / blockSize; }
+};
+
+#endif
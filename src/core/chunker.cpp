@@ -0,0 +1,41 @@
+#include "chunker.h"
+
+// normalised chunking: a stricter mask before the average size, a looser one after it,
+// which keeps most chunks close to CDC_AVG_CHUNK
+#define CDC_MASK_SMALL 0xa525292949480000ULL // 18 bits, spread over the upper half
+#define CDC_MASK_LARGE 0x9224892248900000ULL // 14 bits
+
+struct GearTable {
+    uint64_t values[256];
+    GearTable() {
+        // fixed, every vault has to cut the same data the same way
+        uint64_t x = 0x53464d4344430001ULL;
+        for (uint64_t& v : values) {
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v = z ^ (z >> 31);
+        }
+    }
+};
+
+static const GearTable gear;
+
+size_t findChunkEnd(const uint8_t* data, size_t len) {
+    if (len <= CDC_MIN_CHUNK) return len;
+    size_t limit = (len < CDC_MAX_CHUNK) ? len : CDC_MAX_CHUNK;
+    size_t normal = (limit < CDC_AVG_CHUNK) ? limit : CDC_AVG_CHUNK;
+
+    uint64_t hash = 0;
+    size_t i = CDC_MIN_CHUNK;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear.values[data[i]];
+        if ((hash & CDC_MASK_SMALL) == 0) return i + 1;
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear.values[data[i]];
+        if ((hash & CDC_MASK_LARGE) == 0) return i + 1;
+    }
+    return limit;
+}
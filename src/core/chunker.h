@@ -0,0 +1,19 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#define CDC_MIN_CHUNK (16 * 1024)
+#define CDC_AVG_CHUNK (64 * 1024)
+#define CDC_MAX_CHUNK (256 * 1024)
+
+// Content-defined chunking with a gear rolling hash (FastCDC style). Cut points depend only
+// on the bytes around them, so an insert or delete early in a file only changes the chunks
+// next to the edit and the rest still deduplicate against the previous version.
+//
+// Length of the first chunk of data[0, len). Only the last chunk of a stream may be shorter
+// than CDC_MIN_CHUNK; pass at least CDC_MAX_CHUNK bytes unless the stream ends within len.
+size_t findChunkEnd(const uint8_t* data, size_t len);
+
+#endif
@@ -0,0 +1,81 @@
+#include "cipher.h"
+#include "functions.h"
+#include "segments.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/chachapoly.h>
+
+using namespace CryptoPP;
+
+#define ALGO_BENCH_BYTES (256 * 1024)
+#define ALGO_BENCH_ROUNDS 4
+
+bool isSupportedAlgo(uint32_t algoType) {
+    return algoType == ALGO_AES_256_GCM || algoType == ALGO_CHACHA20_POLY1305;
+}
+
+const char* algoName(uint32_t algoType) {
+    switch (algoType) {
+        case ALGO_AES_256_GCM: return "AES-256-GCM";
+        case ALGO_CHACHA20_POLY1305: return "ChaCha20-Poly1305";
+        case ALGO_AUTO: return "auto";
+        default: return "unknown";
+    }
+}
+
+uint32_t parseAlgo(const std::string& name, bool& ok) {
+    ok = true;
+    if (name == "aes" || name == "aes-gcm") return ALGO_AES_256_GCM;
+    if (name == "chacha" || name == "chacha20") return ALGO_CHACHA20_POLY1305;
+    if (name == "auto") return ALGO_AUTO;
+    ok = false;
+    return ALGO_AUTO;
+}
+
+std::unique_ptr<AuthenticatedSymmetricCipher> makeCipher(uint32_t algoType, bool encrypt,
+                                                         const SecByteBlock& key, const uint8_t* nonce) {
+    std::unique_ptr<AuthenticatedSymmetricCipher> cipher;
+    if (algoType == ALGO_AES_256_GCM) {
+        if (encrypt) cipher.reset(new GCM<AES>::Encryption());
+        else cipher.reset(new GCM<AES>::Decryption());
+    } else if (algoType == ALGO_CHACHA20_POLY1305) {
+        if (encrypt) cipher.reset(new ChaCha20Poly1305::Encryption());
+        else cipher.reset(new ChaCha20Poly1305::Decryption());
+    } else {
+        return nullptr;
+    }
+    cipher->SetKeyWithIV(key, key.size(), nonce, NONCE_SIZE);
+    return cipher;
+}
+
+static double measure(uint32_t algoType) {
+    SecByteBlock key(32);
+    uint8_t nonce[NONCE_SIZE] = {0};
+    std::vector<uint8_t> plain(ALGO_BENCH_BYTES, 0x5a), out(ALGO_BENCH_BYTES + AUTH_TAG_SIZE);
+    auto cipher = makeCipher(algoType, true, key, nonce);
+
+    // best of a few rounds, the first one also pays for warming the caches
+    double best = 1e9;
+    for (int i = 0; i < ALGO_BENCH_ROUNDS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        cipher->EncryptAndAuthenticate(out.data(), out.data() + plain.size(), AUTH_TAG_SIZE,
+            nonce, NONCE_SIZE, nullptr, 0, plain.data(), plain.size());
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (s < best) best = s;
+    }
+    return best;
+}
+
+uint32_t fastestAlgo() {
+    static std::once_flag once;
+    static uint32_t fastest = ALGO_AES_256_GCM;
+    std::call_once(once, []() {
+        // ties go to AES-GCM, every older reader of the format understands it
+        if (measure(ALGO_CHACHA20_POLY1305) < measure(ALGO_AES_256_GCM) * 0.9) fastest = ALGO_CHACHA20_POLY1305;
+    });
+    return fastest;
+}
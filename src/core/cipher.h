@@ -0,0 +1,30 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <cryptopp/secblock.h>
+
+namespace CryptoPP { class AuthenticatedSymmetricCipher; }
+
+// values of SFMHeader::algoType, same numbering as EncryptionAlgo in format/header.h
+#define ALGO_AES_256_GCM 1
+#define ALGO_CHACHA20_POLY1305 2
+#define ALGO_AUTO 0 // only for setCipher: pick the faster one on this host
+
+// Both are 256-bit key, 96-bit nonce, 128-bit tag AEADs, so the segment format is the same for either.
+bool isSupportedAlgo(uint32_t algoType);
+const char* algoName(uint32_t algoType);
+uint32_t parseAlgo(const std::string& name, bool& ok); // aes, chacha, auto
+
+// keyed with the header nonce, sealSegment / openSegment resynchronise per segment
+std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> makeCipher(uint32_t algoType, bool encrypt,
+                                                                   const CryptoPP::SecByteBlock& key, const uint8_t* nonce);
+
+// AES-GCM wins by a wide margin with AES-NI/PCLMUL, ChaCha20-Poly1305 on hosts without them.
+// Measured once per process on the first call (a few ms), then cached.
+uint32_t fastestAlgo();
+
+#endif
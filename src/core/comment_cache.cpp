@@ -0,0 +1,96 @@
+#include "comment_cache.h"
+#include "functions.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#define COMMENT_CACHE_MAGIC "SFMC"
+#define COMMENT_CACHE_VERSION 1
+
+CommentCache::CommentCache(ContainerManager& m, const std::string& cacheFile)
+    : manager(m), cachePath(cacheFile.empty() ? getSFMDirectory() + "/" + COMMENT_CACHE_FILE : cacheFile), dirty(false) {
+    load();
+}
+
+CommentCache::~CommentCache() {
+    save();
+}
+
+const std::string& CommentCache::comment(const std::string& path, uint64_t size, int64_t mtime) {
+    auto it = entries.find(path);
+    if (it != entries.end() && it->second.size == size && it->second.mtime == mtime) {
+        return it->second.comment;
+    }
+
+    Entry& e = entries[path];
+    e.size = size;
+    e.mtime = mtime;
+    e.comment = manager.getFileComment(path);
+    dirty = true;
+    return e.comment;
+}
+
+void CommentCache::forget(const std::string& path) {
+    if (entries.erase(path) > 0) dirty = true;
+}
+
+// records: pathLen | path | size | mtime | commentLen | comment, all little endian as written
+bool CommentCache::load() {
+    std::ifstream in(cachePath, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!in || std::memcmp(magic, COMMENT_CACHE_MAGIC, 4) != 0 || version != COMMENT_CACHE_VERSION) return false;
+
+    while (true) {
+        uint32_t pathLen = 0, commentLen = 0;
+        Entry e;
+        if (!in.read(reinterpret_cast<char*>(&pathLen), sizeof(pathLen))) break;
+        if (pathLen > 4096) return false;
+        std::string path(pathLen, '\0');
+        in.read(&path[0], pathLen);
+        in.read(reinterpret_cast<char*>(&e.size), sizeof(e.size));
+        in.read(reinterpret_cast<char*>(&e.mtime), sizeof(e.mtime));
+        in.read(reinterpret_cast<char*>(&commentLen), sizeof(commentLen));
+        if (!in || commentLen > 128) return false; // SFMHeader comments are at most 127 bytes
+        e.comment.resize(commentLen);
+        in.read(&e.comment[0], commentLen);
+        if (!in) return false;
+        entries[path] = e;
+    }
+    return true;
+}
+
+bool CommentCache::save() {
+    if (!dirty) return true;
+
+    // written next to the old cache and renamed over it, a crash never leaves half a file
+    std::string tmp = cachePath + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        uint32_t version = COMMENT_CACHE_VERSION;
+        out.write(COMMENT_CACHE_MAGIC, 4);
+        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        for (const auto& kv : entries) {
+            uint32_t pathLen = static_cast<uint32_t>(kv.first.size());
+            uint32_t commentLen = static_cast<uint32_t>(kv.second.comment.size());
+            out.write(reinterpret_cast<const char*>(&pathLen), sizeof(pathLen));
+            out.write(kv.first.data(), pathLen);
+            out.write(reinterpret_cast<const char*>(&kv.second.size), sizeof(kv.second.size));
+            out.write(reinterpret_cast<const char*>(&kv.second.mtime), sizeof(kv.second.mtime));
+            out.write(reinterpret_cast<const char*>(&commentLen), sizeof(commentLen));
+            out.write(kv.second.comment.data(), commentLen);
+        }
+        if (!out.good()) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, cachePath, ec);
+    if (ec) return false;
+    dirty = false;
+    return true;
+}
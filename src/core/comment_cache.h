@@ -0,0 +1,39 @@
+#ifndef COMMENT_CACHE_H
+#define COMMENT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+class ContainerManager;
+
+#define COMMENT_CACHE_FILE "comments.cache"
+
+// Header comments of .sfm files keyed by path and validated by size + mtime, so the file browser
+// only opens files that changed since they were last seen. Persisted under getSFMDirectory().
+class CommentCache {
+public:
+    explicit CommentCache(ContainerManager& manager, const std::string& cacheFile = "");
+    ~CommentCache();
+
+    // the file is opened only when size or mtime differ from the cached entry
+    const std::string& comment(const std::string& path, uint64_t size, int64_t mtime);
+
+    bool load();
+    bool save(); // no-op when nothing changed
+    void forget(const std::string& path);
+
+private:
+    struct Entry {
+        uint64_t size;
+        int64_t mtime;
+        std::string comment;
+    };
+
+    ContainerManager& manager;
+    std::string cachePath;
+    std::unordered_map<std::string, Entry> entries;
+    bool dirty;
+};
+
+#endif
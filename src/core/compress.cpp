@@ -0,0 +1,78 @@
+#include "compress.h"
+#include <cmath>
+
+#include <cryptopp/filters.h>
+#include <cryptopp/zdeflate.h>
+#include <cryptopp/zinflate.h>
+
+using namespace CryptoPP;
+
+#define DEFLATE_LEVEL 1          // logs and CSVs already shrink several times at the fastest level
+#define ENTROPY_SKIP_BITS 7.5    // above this deflate would not win anything worth the time
+#define ENTROPY_SAMPLE_BYTES 4096
+
+bool isSupportedCodec(uint32_t codec) {
+    return codec == CODEC_NONE || codec == CODEC_DEFLATE;
+}
+
+const char* codecName(uint32_t codec) {
+    switch (codec) {
+        case CODEC_NONE: return "none";
+        case CODEC_DEFLATE: return "deflate";
+        default: return "unknown";
+    }
+}
+
+uint32_t parseCodec(const std::string& name, bool& ok) {
+    ok = true;
+    if (name == "none" || name == "off") return CODEC_NONE;
+    if (name == "deflate" || name == "on") return CODEC_DEFLATE;
+    ok = false;
+    return CODEC_NONE;
+}
+
+double estimateEntropy(const uint8_t* data, size_t len) {
+    if (len == 0) return 0;
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < len; i++) counts[data[i]]++;
+
+    double bits = 0;
+    for (size_t c : counts) {
+        if (c == 0) continue;
+        double p = static_cast<double>(c) / len;
+        bits -= p * std::log2(p);
+    }
+    return bits;
+}
+
+size_t compressSegment(uint32_t codec, const uint8_t* plain, size_t len, uint8_t* out) {
+    if (codec != CODEC_DEFLATE || len == 0) return 0;
+    // a few spread out samples are enough to spot encrypted / already compressed input
+    size_t step = (len > ENTROPY_SAMPLE_BYTES) ? len / 4 : len;
+    size_t sample = (len > ENTROPY_SAMPLE_BYTES) ? ENTROPY_SAMPLE_BYTES / 4 : len;
+    double bits = 0;
+    int samples = 0;
+    for (size_t at = 0; at + sample <= len; at += step, samples++) bits += estimateEntropy(plain + at, sample);
+    if (samples > 0 && bits / samples > ENTROPY_SKIP_BITS) return 0;
+
+    try {
+        // the sink counts what did not fit, anything that does not shrink is stored raw
+        ArraySink sink(out, len);
+        ArraySource(plain, len, true, new Deflator(new Redirector(sink), DEFLATE_LEVEL));
+        size_t packed = static_cast<size_t>(sink.TotalPutLength());
+        return (packed < len) ? packed : 0;
+    } catch (const Exception&) {
+        return 0;
+    }
+}
+
+bool decompressSegment(uint32_t codec, const uint8_t* in, size_t len, uint8_t* plain, size_t plainLen) {
+    if (codec != CODEC_DEFLATE) return false;
+    try {
+        ArraySink sink(plain, plainLen);
+        ArraySource(in, len, true, new Inflator(new Redirector(sink)));
+        return sink.TotalPutLength() == plainLen;
+    } catch (const Exception&) {
+        return false;
+    }
+}
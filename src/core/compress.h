@@ -0,0 +1,28 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// values of SegmentHeader::codec
+#define CODEC_NONE 0
+#define CODEC_DEFLATE 1 // raw deflate (Crypto++ Deflator), one stream per segment
+
+#define SEGMENT_FLAG_COMPRESSED 1 // SegmentEntry::flags: the segment holds codec output, not plaintext
+
+// Segments are compressed one by one so range reads and the parallel pipeline keep working.
+// A segment that does not shrink is stored as is and only costs the entropy estimate.
+bool isSupportedCodec(uint32_t codec);
+const char* codecName(uint32_t codec);
+uint32_t parseCodec(const std::string& name, bool& ok); // none, deflate
+
+// bits per byte from a byte histogram, 8.0 for random / encrypted / already compressed data
+double estimateEntropy(const uint8_t* data, size_t len);
+
+// compressed size written to out (room for len bytes), 0 when the segment should be stored raw
+size_t compressSegment(uint32_t codec, const uint8_t* plain, size_t len, uint8_t* out);
+// false unless the data inflates to exactly plainLen bytes
+bool decompressSegment(uint32_t codec, const uint8_t* in, size_t len, uint8_t* plain, size_t plainLen);
+
+#endif
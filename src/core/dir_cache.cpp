@@ -0,0 +1,189 @@
+#include "dir_cache.h"
+#include <algorithm>
+#include <filesystem>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <climits>
+#endif
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+#define DIR_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | \
+                        IN_DELETE_SELF | IN_MOVE_SELF)
+
+static bool entryBefore(const ListingEntry& a, const ListingEntry& b) {
+    if (a.isDir != b.isDir) return a.isDir;
+    return a.name < b.name;
+}
+
+bool statEntry(const std::string& dir, const std::string& name, ListingEntry& entry) {
+    entry.name = name;
+    entry.path = (fs::path(dir) / name).string();
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(entry.path.c_str(), &st) != 0) return false;
+    entry.isDir = S_ISDIR(st.st_mode);
+    entry.size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+    entry.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    entry.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+#else
+    std::error_code ec;
+    fs::file_status status = fs::status(entry.path, ec);
+    if (ec) return false;
+    entry.isDir = fs::is_directory(status);
+    entry.size = entry.isDir ? 0 : fs::file_size(entry.path, ec);
+    entry.mtime = fs::last_write_time(entry.path, ec).time_since_epoch().count();
+    return true;
+#endif
+}
+
+static int64_t directoryMtime(const std::string& dir) {
+    ListingEntry self;
+    fs::path p(dir);
+    return statEntry(p.parent_path().string(), p.filename().string(), self) ? self.mtime : -1;
+}
+
+DirectoryCache::DirectoryCache() : inotifyFd(-1), clock(0) {
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+DirectoryCache::~DirectoryCache() {
+#ifdef __linux__
+    if (inotifyFd >= 0) ::close(inotifyFd);
+#endif
+}
+
+const std::vector<ListingEntry>& DirectoryCache::list(const std::string& dir) {
+    poll();
+
+    auto it = listings.find(dir);
+    if (it == listings.end()) {
+        evict();
+        Listing fresh;
+        fresh.stale = true;
+        fresh.watch = -1;
+        fresh.dirMtime = -1;
+        fresh.lastUsed = 0;
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            fresh.watch = inotify_add_watch(inotifyFd, dir.c_str(), DIR_WATCH_MASK | IN_ONLYDIR);
+            if (fresh.watch >= 0) watches[fresh.watch] = dir;
+        }
+#endif
+        it = listings.emplace(dir, std::move(fresh)).first;
+    }
+
+    Listing& listing = it->second;
+    listing.lastUsed = ++clock;
+    // without a watch, the directory's mtime tells whether entries were added or removed
+    if (listing.watch < 0) {
+        int64_t mtime = directoryMtime(dir);
+        if (mtime != listing.dirMtime) {
+            listing.dirMtime = mtime;
+            listing.stale = true;
+        }
+    }
+    if (listing.stale) rebuild(dir, listing);
+    return listing.entries;
+}
+
+void DirectoryCache::invalidate(const std::string& dir) {
+    auto it = listings.find(dir);
+    if (it != listings.end()) it->second.stale = true;
+}
+
+void DirectoryCache::rebuild(const std::string& dir, Listing& listing) {
+    listing.entries.clear();
+    std::error_code ec;
+    for (fs::directory_iterator d(dir, ec), end; !ec && d != end; d.increment(ec)) {
+        ListingEntry entry;
+        if (statEntry(dir, d->path().filename().string(), entry)) listing.entries.push_back(std::move(entry));
+    }
+    std::sort(listing.entries.begin(), listing.entries.end(), entryBefore);
+    listing.stale = false;
+}
+
+void DirectoryCache::upsert(Listing& listing, const std::string& dir, const std::string& name) {
+    erase(listing, name);
+    ListingEntry entry;
+    if (!statEntry(dir, name, entry)) return;
+    auto pos = std::lower_bound(listing.entries.begin(), listing.entries.end(), entry, entryBefore);
+    listing.entries.insert(pos, std::move(entry));
+}
+
+void DirectoryCache::erase(Listing& listing, const std::string& name) {
+    // the entry may be listed as a file or a directory, try both positions
+    for (bool isDir : {true, false}) {
+        ListingEntry key;
+        key.name = name;
+        key.isDir = isDir;
+        auto pos = std::lower_bound(listing.entries.begin(), listing.entries.end(), key, entryBefore);
+        if (pos != listing.entries.end() && pos->name == name && pos->isDir == isDir) {
+            listing.entries.erase(pos);
+            return;
+        }
+    }
+}
+
+void DirectoryCache::poll() {
+#ifdef __linux__
+    if (inotifyFd < 0) return;
+    alignas(struct inotify_event) char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+    while (true) {
+        ssize_t len = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (len <= 0) return; // EAGAIN: nothing pending
+
+        for (char* p = buffer; p < buffer + len; ) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                for (auto& kv : listings) kv.second.stale = true;
+                continue;
+            }
+            auto w = watches.find(ev->wd);
+            if (w == watches.end()) continue;
+            auto it = listings.find(w->second);
+            if (it == listings.end()) continue;
+            Listing& listing = it->second;
+            if (listing.stale) continue; // rebuilt on the next list() anyway
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                listing.stale = true;
+            } else if (ev->len > 0) {
+                std::string name(ev->name);
+                if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) erase(listing, name);
+                else upsert(listing, w->second, name);
+            }
+        }
+    }
+#endif
+}
+
+void DirectoryCache::evict() {
+    if (listings.size() < DIR_CACHE_MAX_DIRS) return;
+
+    auto oldest = listings.begin();
+    for (auto it = listings.begin(); it != listings.end(); ++it) {
+        if (it->second.lastUsed < oldest->second.lastUsed) oldest = it;
+    }
+#ifdef __linux__
+    if (oldest->second.watch >= 0) {
+        inotify_rm_watch(inotifyFd, oldest->second.watch);
+        watches.erase(oldest->second.watch);
+    }
+#endif
+    listings.erase(oldest);
+}
@@ -0,0 +1,54 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DIR_CACHE_MAX_DIRS 16
+
+// one stat per entry, taken when the entry is first seen or reported changed
+struct ListingEntry {
+    std::string name;
+    std::string path;
+    bool isDir;
+    uint64_t size;
+    int64_t mtime; // nanoseconds
+};
+
+// Sorted directory listings (directories first, then by name) that survive between keypresses.
+// On Linux every cached directory has an inotify watch and events are applied entry by entry,
+// elsewhere a listing is rebuilt when the directory's own mtime moves.
+class DirectoryCache {
+public:
+    DirectoryCache();
+    ~DirectoryCache();
+
+    const std::vector<ListingEntry>& list(const std::string& dir);
+    void invalidate(const std::string& dir);
+
+private:
+    struct Listing {
+        std::vector<ListingEntry> entries;
+        bool stale;
+        int watch;
+        int64_t dirMtime;
+        uint64_t lastUsed;
+    };
+
+    std::unordered_map<std::string, Listing> listings;
+    std::unordered_map<int, std::string> watches;
+    int inotifyFd;
+    uint64_t clock;
+
+    void poll();
+    void rebuild(const std::string& dir, Listing& listing);
+    void evict();
+    void upsert(Listing& listing, const std::string& dir, const std::string& name);
+    void erase(Listing& listing, const std::string& name);
+};
+
+bool statEntry(const std::string& dir, const std::string& name, ListingEntry& entry);
+
+#endif
@@ -1,10 +1,30 @@
 #include "functions.h"
+#include "cipher.h"
+#include "compress.h"
+#include "io.h"
+#include "kdf.h"
+#include "legacy.h"
+#include "mount.h"
+#include "segments.h"
+#include "segment_cache.h"
+#include "parallel.h"
+#include "progress.h"
+#include "session.h"
+#include "store.h"
+#include "thread_pool.h"
+#include "vault.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <cstring>
 #include <filesystem>
 #include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <future>
 
 #include <cryptopp/osrng.h>
 #include <cryptopp/scrypt.h>
@@ -50,7 +70,67 @@ std::string resolvePath(const std::string& filename) {
     return filename;
 }
 
-ContainerManager::ContainerManager() { }
+ContainerManager::ContainerManager() : threadCount(defaultThreadCount()), cipherAlgo(ALGO_AUTO), codec(CODEC_NONE), progress(nullptr), session(new KeySession()),
+                                       cacheBytes(SEGMENT_CACHE_DEFAULT_BYTES) {
+    // calibrated with kdf-calibrate, the built-in 64 / 32768 when there is no profile
+    loadKdfProfile(KDF_DEFAULT_PROFILE, kdfProfile);
+    session->setKdfProfile(kdfProfile);
+}
+
+ContainerManager::~ContainerManager() {
+    std::lock_guard<std::mutex> lock(vaultsMutex);
+    openVaults.clear(); // Vault::close writes back whatever is still cached
+}
+
+void ContainerManager::unlockSession(const std::string& password) {
+    usePassword(password);
+}
+
+void ContainerManager::lockSession() {
+    session->clear();
+}
+
+void ContainerManager::warmSession() {
+    session->warm();
+}
+
+bool ContainerManager::isSessionUnlocked() {
+    return session->hasPassword();
+}
+
+void ContainerManager::usePassword(const std::string& password) {
+    if (password.empty() && session->hasPassword()) return; // the one the session was unlocked with
+    session->setPassword(password);
+}
+
+void ContainerManager::setThreadCount(int threads) {
+    threadCount = (threads < 1) ? 1 : threads;
+}
+
+void ContainerManager::setCipher(uint32_t algoType) {
+    cipherAlgo = algoType;
+}
+
+void ContainerManager::setCompression(uint32_t newCodec) {
+    codec = newCodec;
+}
+
+bool ContainerManager::setKdfProfile(const std::string& name) {
+    KdfProfile profile;
+    // an uncalibrated machine still has the default, it is the built-in cost
+    if (!loadKdfProfile(name, profile) && name != KDF_DEFAULT_PROFILE) return false;
+    kdfProfile = profile;
+    session->setKdfProfile(profile);
+    return true;
+}
+
+void ContainerManager::setWipeOptions(const WipeOptions& options) {
+    wipeOptions = options;
+}
+
+void ContainerManager::setProgress(JobProgress* newProgress) {
+    progress = newProgress;
+}
 
 
 bool ContainerManager::isPasswordSet(const std::string& hashFile) {
@@ -76,11 +156,178 @@ bool ContainerManager::setPassword(const std::string& hashFile, const std::strin
     return true;
 }
 
-bool ContainerManager::changePassword(const std::string& hashFile, const std::string& oldPassword, const std::string& newPassword) {
-    if (authenticate(hashFile, oldPassword)) {
-        return setPassword(hashFile, newPassword);
+// the SegmentHeader of a .sfm file or vault whose key sits in key slots
+static bool readKeySlots(const std::string& path, SFMHeader& header, SegmentHeader& seg) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader))) return false;
+    if (std::memcmp(header.magic, "SFM", 4) != 0) return false;
+    if (header.version != SFM_VERSION_SEGMENTED && header.version != SFM_VERSION_VAULT &&
+        header.version != SFM_VERSION_VAULT_V3) return false;
+    return readSegmentHeader(in, seg) && seg.keyMode == KEY_MODE_WRAPPED && seg.headerSize >= sizeof(SegmentHeader);
+}
+
+// only the header is rewritten, a few hundred bytes whatever the size of the file
+static bool writeKeySlots(const std::string& path, const SegmentHeader& seg) {
+    std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!out.is_open()) return false;
+    out.seekp(sizeof(SFMHeader));
+    out.write(reinterpret_cast<const char*>(&seg), sizeof(SegmentHeader));
+    out.flush();
+    return out.good();
+}
+
+// wraps the file key `from` opens into a free slot for `to`, the old slot stays until clearKeySlot.
+// oldSlot is -1 when `from` opens no slot, newSlot == oldSlot when the slot had to be overwritten
+static bool addKeySlotFor(const std::string& path, KeySession& from, KeySession& to, bool overwrite, int& oldSlot, int& newSlot) {
+    SFMHeader header;
+    SegmentHeader seg;
+    oldSlot = newSlot = -1;
+    if (!readKeySlots(path, header, seg)) return false;
+
+    SecByteBlock dataKey;
+    oldSlot = from.unwrapKey(header, seg, dataKey);
+    if (oldSlot < 0) return false;
+
+    for (int i = 0; i < KEY_SLOT_COUNT && newSlot < 0; i++) {
+        if (!(seg.keySlots[i].flags & KEY_SLOT_USED)) newSlot = i;
     }
-    return false;
+    if (newSlot < 0) {
+        if (!overwrite) return false;
+        newSlot = oldSlot;
+    }
+    to.wrapKey(header, seg, newSlot, dataKey);
+    return writeKeySlots(path, seg);
+}
+
+static bool putKeySlot(const std::string& path, int slot, const KeySlot& value) {
+    SFMHeader header;
+    SegmentHeader seg;
+    if (!readKeySlots(path, header, seg)) return false;
+    seg.keySlots[slot] = value;
+    return writeKeySlots(path, seg);
+}
+
+static bool clearKeySlot(const std::string& path, int slot) {
+    KeySlot empty;
+    std::memset(&empty, 0, sizeof(KeySlot));
+    return putKeySlot(path, slot, empty);
+}
+
+bool ContainerManager::changePassword(const std::string& hashFile, const std::string& oldPassword, const std::string& newPassword,
+                                      const std::vector<std::string>& extraFiles) {
+    namespace fs = std::filesystem;
+    if (!authenticate(hashFile, oldPassword)) return false;
+
+    KeySession oldKeys, newKeys;
+    oldKeys.setPassword(oldPassword);
+    newKeys.setPassword(newPassword);
+    newKeys.setKdfProfile(kdfProfile);
+
+    // everything in ~/.sfm plus the vaults kept elsewhere
+    std::vector<std::string> files(extraFiles);
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(getSFMDirectory(), fs::directory_options::skip_permission_denied, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        if (it->is_regular_file(ec)) files.push_back(it->path().string());
+    }
+
+    // phase one: a slot for the new password next to the old one, both work until phase two.
+    // a failure removes the slots added so far and leaves the old password in place. a file with
+    // no free slot has its old one overwritten, the saved bytes put it back on rollback
+    struct Rewrapped { std::string path; int oldSlot; int newSlot; KeySlot saved; };
+    std::vector<Rewrapped> done;
+    uint64_t legacy = 0;
+    bool ok = true;
+    for (const std::string& path : files) {
+        SFMHeader header;
+        SegmentHeader seg;
+        if (!readKeySlots(path, header, seg)) {
+            std::ifstream probe(path, std::ios::binary);
+            if (probe.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader)) && std::memcmp(header.magic, "SFM", 4) == 0) legacy++;
+            continue;
+        }
+
+        int oldSlot, newSlot;
+        if (!addKeySlotFor(path, oldKeys, newKeys, true, oldSlot, newSlot)) {
+            if (oldSlot < 0) continue; // another password's file
+            std::cerr << "[Error] Could not rewrap the key of " << path << "\n";
+            ok = false;
+            break;
+        }
+        done.push_back({path, oldSlot, newSlot, seg.keySlots[oldSlot]});
+    }
+
+    if (!ok || !setPassword(hashFile, newPassword)) {
+        for (const Rewrapped& r : done) {
+            bool undone = (r.newSlot != r.oldSlot) ? clearKeySlot(r.path, r.newSlot) : putKeySlot(r.path, r.oldSlot, r.saved);
+            if (!undone && r.newSlot == r.oldSlot) {
+                std::cerr << "[Error] Could not restore the old key slot of " << r.path << ", it now opens with the new password.\n";
+            }
+        }
+        return false;
+    }
+
+    for (const Rewrapped& r : done) {
+        if (r.newSlot != r.oldSlot && !clearKeySlot(r.path, r.oldSlot)) {
+            std::cerr << "[Error] Old key slot of " << r.path << " is still there.\n";
+        }
+    }
+
+    session->setPassword(newPassword);
+    std::cout << "[Success] Rewrapped the key of " << done.size() << " file(s).\n";
+    if (legacy > 0) {
+        std::cout << "[Core] " << legacy << " file(s) from before key slots still need the old password, "
+                  << "decrypt and encrypt them again to move them over.\n";
+    }
+    return true;
+}
+
+bool ContainerManager::addKeySlot(const std::string& filePath, const std::string& password, const std::string& newPassword) {
+    std::string path = resolvePath(filePath);
+    usePassword(password);
+    KeySession newKeys;
+    newKeys.setPassword(newPassword);
+    newKeys.setKdfProfile(kdfProfile);
+
+    int oldSlot, newSlot;
+    if (!addKeySlotFor(path, *session, newKeys, false, oldSlot, newSlot)) {
+        if (oldSlot < 0) std::cerr << "[Access Denied] No key slot of " << path << " opens with this password.\n";
+        else std::cerr << "[Error] All " << KEY_SLOT_COUNT << " key slots of " << path << " are in use.\n";
+        return false;
+    }
+    std::cout << "[Success] Added key slot " << newSlot << " to " << path << "\n";
+    return true;
+}
+
+bool ContainerManager::removeKeySlot(const std::string& filePath, const std::string& password) {
+    std::string path = resolvePath(filePath);
+    SFMHeader header;
+    SegmentHeader seg;
+    if (!readKeySlots(path, header, seg)) {
+        std::cerr << "[Error] " << path << " has no key slots.\n";
+        return false;
+    }
+
+    usePassword(password);
+    SecByteBlock dataKey;
+    int slot = session->unwrapKey(header, seg, dataKey);
+    if (slot < 0) {
+        std::cerr << "[Access Denied] No key slot of " << path << " opens with this password.\n";
+        return false;
+    }
+
+    int used = 0;
+    for (const KeySlot& k : seg.keySlots) {
+        if (k.flags & KEY_SLOT_USED) used++;
+    }
+    if (used < 2) {
+        std::cerr << "[Error] Refusing to remove the last key slot, the file could never be opened again.\n";
+        return false;
+    }
+    if (!clearKeySlot(path, slot)) return false;
+    std::cout << "[Success] Removed key slot " << slot << " from " << path << "\n";
+    return true;
 }
 
 std::string ContainerManager::saveFileDialog() {
@@ -165,58 +412,24 @@ void ContainerManager::openWithDefaultApp(const std::string& filePath) {
 }
  
 
-bool ContainerManager::createContainer(const std::string& filePath, const std::string& password, long sizeInBytes) {
+static bool isCancelled(JobProgress* progress) {
+    return progress && progress->cancelled();
+}
+
+bool ContainerManager::createContainer(const std::string& filePath, const std::string& password, long sizeInBytes, bool prefill) {
     std::cout << "[Core] Initializing Secure Container...\n";
 
     SFMHeader header = createDefaultHeader();
 
-    AutoSeededRandomPool prng;
-    prng.GenerateBlock(header.kdfSalt, SALT_SIZE);
-    prng.GenerateBlock(header.encryptionNonce, NONCE_SIZE);
-
-    SecByteBlock masterKey(32);
-    Scrypt kdf;
-    kdf.DeriveKey(
-        masterKey, masterKey.size(),
-        (const byte*)password.data(), password.size(),
-        header.kdfSalt, SALT_SIZE,
-        header.kdfMemoryCost,
-        header.kdfIterations
-    );
+    usePassword(password);
 
     try {
-        GCM<AES>::Encryption encryptor;
-        encryptor.SetKeyWithIV(masterKey, masterKey.size(), header.encryptionNonce, NONCE_SIZE);
-
-        std::ofstream file(filePath, std::ios::binary);
-        if (!file.is_open()) return false;
-
-        file.write(reinterpret_cast<const char*>(&header), sizeof(SFMHeader));
-        
-        AuthenticatedEncryptionFilter filter(encryptor, new FileSink(file));
-
-        VaultIndex index;
-        std::memset(&index, 0, sizeof(VaultIndex));
-
-        filter.Put(reinterpret_cast<const byte*>(&index), sizeof(VaultIndex));
-
-        const int CHUNK_SIZE = 4096;
-        std::vector<byte> emptyBlock(CHUNK_SIZE, 0);
-
-        long remainingBytes = sizeInBytes - sizeof(VaultIndex);
-        long bytesWritten = 0;
-        
-        while (bytesWritten < remainingBytes) {
-            long remainingChunk = remainingBytes - bytesWritten;
-            long currentChunk = (remainingChunk < CHUNK_SIZE) ? remainingChunk : CHUNK_SIZE;
-            filter.Put(emptyBlock.data(), currentChunk);
-            bytesWritten += currentChunk;
+        // only the metadata and the index segment are written, the rest is encrypted on first write
+        if (!Vault::create(filePath, *session, header, sizeInBytes, prefill, progress)) {
+            if (isCancelled(progress)) std::cout << "[Core] Cancelled, the partial vault was removed.\n";
+            else std::cerr << "[Error] Could not create vault: " << filePath << "\n";
+            return false;
         }
-        
-        filter.MessageEnd();
-        file.close();
-
-        masterKey.CleanNew(masterKey.size());
         return true;
 
     } catch (const Exception& e) {
@@ -230,9 +443,9 @@ SFMHeader ContainerManager::createDefaultHeader() {
     std::memset(&header, 0, sizeof(SFMHeader));
     header.magic[0] = 'S'; header.magic[1] = 'F'; header.magic[2] = 'M'; header.magic[3] = '\0';
     header.version = 1;
-    header.algoType = 1;
-    header.kdfIterations = 32768;
-    header.kdfMemoryCost = 64;
+    header.algoType = (cipherAlgo == ALGO_AUTO) ? fastestAlgo() : cipherAlgo;
+    header.kdfIterations = kdfProfile.blockSize;
+    header.kdfMemoryCost = kdfProfile.cost;
 
     return header;
 }
@@ -260,20 +473,36 @@ bool ContainerManager::openContainer(const std::string& filePath, const std::str
         return false;
     }
 
-    if (header.version != 1) {
+    if (header.version != SFM_VERSION_STREAM && header.version != SFM_VERSION_VAULT && header.version != SFM_VERSION_VAULT_V3) {
         std::cerr << "[Error] Unsupported version.\n";
         return false;
     }
 
-    SecByteBlock masterKey(32);
-    Scrypt kdf;
-    kdf.DeriveKey(
-        masterKey, masterKey.size(),
-        (const byte*)password.data(), password.size(),
-        header.kdfSalt, SALT_SIZE,
-        header.kdfMemoryCost,
-        header.kdfIterations
-    );
+    usePassword(password);
+
+    if (header.version == SFM_VERSION_VAULT || header.version == SFM_VERSION_VAULT_V3) {
+        file.close();
+        try {
+            Vault vault;
+            if (vault.open(filePath, *session)) {
+                // segment 0 holds the store superblock, a fresh vault gets formatted here
+                VaultStore store(vault);
+                if (store.open() && (vault.isReadOnly() || store.flush())) {
+                    std::cout << "[Success] Vault Unlocked. " << store.fileCount() << " file(s), "
+                              << store.freeBytes() << " bytes free.\n";
+                    if (vault.isReadOnly()) std::cout << "[Core] Old vault format, read-only: extract its files into a new vault.\n";
+                    return true;
+                }
+            }
+        } catch (const Exception& e) {
+            std::cerr << "[Crypto Error] " << e.what() << "\n";
+            return false;
+        }
+        std::cerr << "[Access Denied] Incorrect Password.\n";
+        return false;
+    }
+
+    SecByteBlock masterKey = session->masterKey(header);
 
     try {
         const int indexSize = sizeof(VaultIndex);
@@ -310,110 +539,827 @@ bool ContainerManager::openContainer(const std::string& filePath, const std::str
     }
 }
 
+#define KDF_PREFETCH_BYTES (8 * 1024 * 1024) // read ahead while scrypt runs
+
+// plaintext bytes in the chunk's segments
+static uint64_t chunkPlainLength(const SegmentHeader& seg, const SegmentChunk& chunk) {
+    uint64_t end = std::min(seg.plainSize, (chunk.first + chunk.count) * seg.segmentSize);
+    return end - chunk.first * seg.segmentSize;
+}
+
+// file key on its own thread when scrypt has to run, so the caller can set up its I/O meanwhile.
+// a cached master key only costs an HKDF or an unwrap, that runs inline on get().
+// the header's kdf fields are those of the slot the file was written with
+static std::future<SecByteBlock> deriveKeyAsync(KeySession& session, const SFMHeader& header, const SegmentHeader& seg) {
+    auto derive = [&session, header, seg]() { return session.fileKey(header, seg); };
+    bool cached = session.isCached(header, seg.kdfParallelism);
+    return std::async(cached ? std::launch::deferred : std::launch::async, derive);
+}
+
+// points chunk.src at the plaintext [offset, offset + len), called in order on the pipeline's read thread
+typedef std::function<bool(uint64_t offset, size_t len, SegmentChunk& chunk)> PlainReader;
+
+// seals plainSize bytes from readPlain into realOutput as a version 2 file. a failed or cancelled
+// run removes the output, the caller reports it
+static bool sealToFile(uint64_t plainSize, const PlainReader& readPlain, const std::string& realOutput, KeySession& session,
+                       SFMHeader header, uint32_t codec, int threads, JobProgress* progress, bool exclusive = false) {
+    try {
+        AutoSeededRandomPool prng;
+        prng.GenerateBlock(header.encryptionNonce, NONCE_SIZE);
+
+        SegmentHeader seg = createSegmentHeader(plainSize);
+        seg.keyMode = KEY_MODE_WRAPPED;
+        seg.codec = codec;
+        prng.GenerateBlock(seg.fileSalt, FILE_SALT_SIZE);
+
+        // scrypt only runs for the first file of a session, the file key is random and only wrapped under it.
+        // either way it runs while the output is created and the input starts streaming in.
+        // the wrap fills seg.keySlots, nothing else touches them until get()
+        session.prepareHeader(header, seg);
+        bool cached = session.isCached(header, seg.kdfParallelism);
+        std::future<SecByteBlock> pendingKey = std::async(cached ? std::launch::deferred : std::launch::async,
+            [&session, &header, &seg]() { return session.newDataKey(header, seg); });
+
+        // the table is the uncompressed layout until the segments are written, so totalSize is the worst case
+        uint64_t tableOffset = sizeof(SFMHeader) + sizeof(SegmentHeader);
+        uint64_t dataOffset = tableOffset + seg.segmentCount * sizeof(SegmentEntry);
+        std::vector<SegmentEntry> table = buildSegmentTable(seg, dataOffset);
+        uint64_t totalSize = table.back().offset + table.back().length;
+
+        OutputFile outFile;
+        if (!outFile.open(realOutput, totalSize, exclusive)) {
+            std::cerr << "[Error] Cannot create: " << realOutput << "\n";
+            return false;
+        }
+
+        SecByteBlock fileKey = pendingKey.get();
+        bool ok = outFile.writeAt(0, reinterpret_cast<const uint8_t*>(&header), sizeof(SFMHeader)) &&
+                  outFile.writeAt(sizeof(SFMHeader), reinterpret_cast<const uint8_t*>(&seg), sizeof(SegmentHeader));
+
+        // one cipher object per worker, segments are sealed independently
+        std::vector<std::unique_ptr<AuthenticatedSymmetricCipher>> encryptors;
+        for (int w = 0; w < threads; w++) {
+            encryptors.push_back(makeCipher(header.algoType, true, fileKey, header.encryptionNonce));
+            if (!encryptors.back()) ok = false;
+        }
+        std::vector<std::vector<uint8_t>> packed(threads);
+        if (codec != CODEC_NONE) {
+            for (auto& buffer : packed) buffer.resize(seg.segmentSize);
+        }
+
+        // sealed straight from the reader's buffer (the mapped input for enc) into the chunk's reused output buffer.
+        // compressed segments shrink, the write stage packs them back to back in segment order
+        uint64_t writePos = dataOffset;
+        ok = ok && runSegmentPipeline(0, seg.segmentCount - 1, threads,
+            [&](SegmentChunk& chunk) {
+                return readPlain(chunk.first * seg.segmentSize, chunkPlainLength(seg, chunk), chunk);
+            },
+            [&](SegmentChunk& chunk, int worker) {
+                size_t inLen = 0;
+                for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) inLen += segmentPlainLength(seg, i);
+                chunk.out.resize(inLen + chunk.count * AUTH_TAG_SIZE);
+                const byte* plain = chunk.src;
+                byte* cipher = chunk.out.data();
+                for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) {
+                    size_t len = segmentPlainLength(seg, i);
+                    // the table entries of a chunk belong to its worker until the write stage
+                    size_t stored = compressSegment(codec, plain, len, packed[worker].data());
+                    if (stored > 0) {
+                        sealSegment(*encryptors[worker], header.encryptionNonce, seg, i, packed[worker].data(), stored, cipher,
+                                    SEGMENT_FLAG_COMPRESSED);
+                        table[i].flags = SEGMENT_FLAG_COMPRESSED;
+                    } else {
+                        stored = len;
+                        sealSegment(*encryptors[worker], header.encryptionNonce, seg, i, plain, len, cipher);
+                    }
+                    table[i].length = static_cast<uint32_t>(stored + AUTH_TAG_SIZE);
+                    plain += len;
+                    cipher += table[i].length;
+                }
+                chunk.out.resize(cipher - chunk.out.data());
+                return true;
+            },
+            [&](SegmentChunk& chunk) {
+                if (isCancelled(progress)) return false;
+                for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) {
+                    table[i].offset = writePos;
+                    writePos += table[i].length;
+                }
+                if (!outFile.writeAt(table[chunk.first].offset, chunk.out.data(), chunk.out.size())) return false;
+                if (progress) progress->advance(chunkPlainLength(seg, chunk));
+                return true;
+            });
+
+        // the final table, and the space compression saved handed back
+        ok = ok && outFile.writeAt(tableOffset, reinterpret_cast<const uint8_t*>(table.data()), table.size() * sizeof(SegmentEntry));
+        if (ok && writePos < totalSize) ok = outFile.resize(writePos);
+
+        fileKey.CleanNew(fileKey.size());
+        ok = outFile.close() && ok;
+
+        if (!ok) std::remove(realOutput.c_str());
+        return ok;
+
+    } catch (...) {
+        std::remove(realOutput.c_str());
+        return false;
+    }
+}
+
+// seals inputPath into realOutput as a version 2 file, only errors are printed
+static bool encryptToFile(const std::string& inputPath, const std::string& realOutput, KeySession& session,
+                          SFMHeader header, uint32_t codec, int threads, JobProgress* progress) {
+    InputFile inFile;
+    if (!inFile.open(inputPath)) return false;
+    if (progress) progress->begin("Encrypting", inFile.size());
+    inFile.prefetch(0, KDF_PREFETCH_BYTES);
+
+    PlainReader readPlain = [&](uint64_t offset, size_t len, SegmentChunk& chunk) {
+        chunk.src = inFile.view(offset, len, chunk.in);
+        return chunk.src != nullptr;
+    };
+    if (!sealToFile(inFile.size(), readPlain, realOutput, session, header, codec, threads, progress)) {
+        if (isCancelled(progress)) std::cout << "[Core] Cancelled, the partial " << realOutput << " was removed.\n";
+        else std::cerr << "[Error] Failed to encrypt " << inputPath << " (input changed or disk full).\n";
+        return false;
+    }
+    return true;
+}
+
 bool ContainerManager::encryptFile(const std::string& inputPath, const std::string& outputPath, const std::string& password, const std::string& comment) { // comment
     std::cout << "[Core] Encrypting file: " << inputPath << "\n";
 
-    try {
-        std::ifstream inFile(inputPath, std::ios::binary);
-        if (!inFile.is_open()) return false;
+    SFMHeader header = createDefaultHeader();
+    header.version = SFM_VERSION_SEGMENTED;
 
-        std::string realOutput = getSFMDirectory() + "/" + outputPath;
-        std::ofstream outFile(realOutput, std::ios::binary);
+    std::strncpy(header.comment, comment.c_str(), sizeof(header.comment) - 1); // copy the comment into the title
 
-        SFMHeader header = createDefaultHeader();
+    std::string realOutput = getSFMDirectory() + "/" + outputPath;
+    usePassword(password);
+    if (!encryptToFile(inputPath, realOutput, *session, header, codec, threadCount, progress)) return false;
 
-        std::strncpy(header.comment, comment.c_str(), sizeof(header.comment) - 1); // copy the comment into the title
+    std::cout << "[Success] Stored in: " << realOutput << "\n";
 
-        AutoSeededRandomPool prng;
-        prng.GenerateBlock(header.kdfSalt, SALT_SIZE);
-        prng.GenerateBlock(header.encryptionNonce, NONCE_SIZE);
+    //securely wipe the original unencrypted file
+    std::cout << "[Cleanup] Wiping original file...\n";
+    secureDeleteFile(inputPath);
 
-        SecByteBlock masterKey(32);
-        Scrypt kdf;
-        kdf.DeriveKey(masterKey, masterKey.size(),
-            (const byte*)password.data(), password.size(),
-            header.kdfSalt, SALT_SIZE,
-            header.kdfMemoryCost,
-            header.kdfIterations);
+    return true;
+}
 
-        outFile.write(reinterpret_cast<const char*>(&header), sizeof(SFMHeader));
+// writes plaintext bytes [offset, offset + length) of a version 2 file, only the segments covering the range are read
+static bool decryptSegments(InputFile& inFile, const SFMHeader& header, KeySession& session,
+                            const std::string& outputPath, uint64_t offset, uint64_t length, int threads, JobProgress* progress) {
+    SegmentHeader seg;
+    std::vector<SegmentEntry> table;
+    // scrypt starts as soon as the header is known, the table, output and first segments are set up meanwhile
+    std::future<SecByteBlock> pendingKey;
+    {
+        // the header and table are tiny, parse them through the stream helpers
+        std::vector<uint8_t> scratch;
+        uint64_t metaSize = std::min<uint64_t>(inFile.size() - sizeof(SFMHeader), 4096);
+        const uint8_t* meta = inFile.view(sizeof(SFMHeader), metaSize, scratch);
+        std::istringstream metaStream(std::string(reinterpret_cast<const char*>(meta), meta ? metaSize : 0));
+        if (!meta || !readSegmentHeader(metaStream, seg)) {
+            std::cerr << "[Error] Corrupted segment table.\n";
+            return false;
+        }
+        // the count comes from the file, it has to fit in it before anything is sized by it
+        uint64_t tableOffset = sizeof(SFMHeader) + seg.headerSize;
+        if (tableOffset > inFile.size() || seg.segmentCount > (inFile.size() - tableOffset) / sizeof(SegmentEntry)) {
+            std::cerr << "[Error] Corrupted segment table.\n";
+            return false;
+        }
+        pendingKey = deriveKeyAsync(session, header, seg);
+        table.resize(seg.segmentCount);
+        if (!inFile.readAt(tableOffset, reinterpret_cast<uint8_t*>(table.data()), table.size() * sizeof(SegmentEntry))) {
+            std::cerr << "[Error] Corrupted segment table.\n";
+            return false;
+        }
+    }
 
-        GCM<AES>::Encryption encryptor;
-        encryptor.SetKeyWithIV(masterKey, masterKey.size(), header.encryptionNonce, NONCE_SIZE);
+    if (!isSupportedAlgo(header.algoType)) {
+        std::cerr << "[Error] Unsupported cipher: " << header.algoType << "\n";
+        return false;
+    }
+    bool compressed = seg.codec != CODEC_NONE;
+
+    if (offset > seg.plainSize) offset = seg.plainSize;
+    uint64_t end = offset + std::min(length, seg.plainSize - offset);
+    if (progress) progress->begin("Decrypting", end - offset);
+
+    uint64_t first = offset / seg.segmentSize;
+    uint64_t last = (end > offset) ? (end - 1) / seg.segmentSize : first;
+    // nothing to copy: still check one tag so a wrong password is reported
+    if (first >= seg.segmentCount) first = last = seg.segmentCount - 1;
+
+    // chunks are read as one run, so the segments have to be back to back
+    for (uint64_t i = first; i <= last; i++) {
+        uint64_t plainLen = segmentPlainLength(seg, i);
+        bool valid = (table[i].flags & SEGMENT_FLAG_COMPRESSED)
+            ? compressed && table[i].length > AUTH_TAG_SIZE && table[i].length - AUTH_TAG_SIZE < plainLen
+            : table[i].flags == 0 && table[i].length == plainLen + AUTH_TAG_SIZE;
+        if (!valid || (i > first && table[i].offset != table[i - 1].offset + table[i - 1].length)) {
+            std::cerr << "[Error] Corrupted segment table.\n";
+            return false;
+        }
+    }
 
-        FileSource fs(inFile, true,
-            new AuthenticatedEncryptionFilter(encryptor,
-                new FileSink(outFile)
-            )
-        );
+    inFile.prefetch(table[first].offset, KDF_PREFETCH_BYTES);
+    OutputFile outFile;
+    if (!outFile.open(outputPath, end - offset)) return false;
 
-        std::cout << "[Success] Stored in: " << realOutput << "\n";
+    SecByteBlock fileKey = pendingKey.get();
+    if (fileKey.size() != KEY_SIZE) {
+        std::cerr << "[Access Denied] No key slot opens with this password.\n";
+        return false;
+    }
 
-        masterKey.CleanNew(masterKey.size());
+    std::vector<std::unique_ptr<AuthenticatedSymmetricCipher>> decryptors;
+    for (int w = 0; w < threads; w++) {
+        decryptors.push_back(makeCipher(header.algoType, false, fileKey, header.encryptionNonce));
+    }
+    std::vector<std::vector<uint8_t>> packed(threads);
+    if (compressed) {
+        for (auto& buffer : packed) buffer.resize(seg.segmentSize);
+    }
 
-        //the thing that ends the usage of file that we want to wipe
-        inFile.close();
-        outFile.close();
+    bool ok = runSegmentPipeline(first, last, threads,
+        [&](SegmentChunk& chunk) {
+            uint64_t len = 0;
+            for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) len += table[i].length;
+            chunk.src = inFile.view(table[chunk.first].offset, len, chunk.in);
+            if (!chunk.src) {
+                std::cerr << "[Error] File is truncated.\n";
+                return false;
+            }
+            return true;
+        },
+        [&](SegmentChunk& chunk, int worker) {
+            size_t outLen = 0;
+            for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) outLen += segmentPlainLength(seg, i);
+            chunk.out.resize(outLen);
+            const byte* cipher = chunk.src;
+            byte* plain = chunk.out.data();
+            for (uint64_t i = chunk.first; i < chunk.first + chunk.count; i++) {
+                size_t len = table[i].length - AUTH_TAG_SIZE;
+                size_t plainLen = segmentPlainLength(seg, i);
+                bool packedSegment = (table[i].flags & SEGMENT_FLAG_COMPRESSED) != 0;
+                byte* opened = packedSegment ? packed[worker].data() : plain;
+                if (!openSegment(*decryptors[worker], header.encryptionNonce, seg, i, cipher, len, opened, table[i].flags)) {
+                    std::cerr << "[Crypto Error] Segment " << i << " failed authentication.\n";
+                    return false;
+                }
+                if (packedSegment && !decompressSegment(seg.codec, opened, len, plain, plainLen)) {
+                    std::cerr << "[Error] Segment " << i << " does not decompress.\n";
+                    return false;
+                }
+                cipher += table[i].length;
+                plain += plainLen;
+            }
+            return true;
+        },
+        [&](SegmentChunk& chunk) {
+            if (isCancelled(progress)) return false;
+            uint64_t chunkStart = chunk.first * seg.segmentSize;
+            uint64_t from = std::max(offset, chunkStart) - chunkStart;
+            uint64_t to = std::min(end, chunkStart + chunk.out.size()) - chunkStart;
+            if (to <= from) return true;
+            if (!outFile.writeAt(chunkStart + from - offset, chunk.out.data() + from, to - from)) return false;
+            if (progress) progress->advance(to - from);
+            return true;
+        });
+
+    return outFile.close() && ok;
+}
 
-        //securely wipe the original unencrypted file
-        std::cout << "[Cleanup] Wiping original file...\n";
-        secureDeleteFile(inputPath);
-        
-        return true;
+static bool decryptToFile(const std::string& realInput, const std::string& outputPath, KeySession& session,
+                          uint64_t offset, uint64_t length, bool wholeFile, int threads, JobProgress* progress) {
+    SFMHeader header;
+    {
+        std::ifstream probe(realInput, std::ios::binary);
+        if (!probe.is_open()) return false;
+        if (!probe.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader))) {
+            std::cerr << "[Error] Invalid file format!\n";
+            return false;
+        }
+    }
 
-    } catch (...) {
+    if (header.version != SFM_VERSION_STREAM && header.version != SFM_VERSION_SEGMENTED) {
+        std::cerr << "[Error] Unsupported version.\n";
+        return false;
+    }
+    if (header.version == SFM_VERSION_STREAM && !wholeFile) {
+        std::cerr << "[Error] Range reads need a segmented (version 2) file.\n";
         return false;
     }
+
+    bool ok = true;
+    try {
+        if (header.version == SFM_VERSION_SEGMENTED) {
+            InputFile inFile;
+            ok = inFile.open(realInput) && decryptSegments(inFile, header, session, outputPath, offset, length, threads, progress);
+        } else {
+            // legacy single-message files keep the filter chain, they cannot be split up (or cancelled) anyway
+            if (progress) progress->begin("Decrypting", 0);
+            std::ifstream inFile(realInput, std::ios::binary);
+            inFile.seekg(sizeof(SFMHeader));
+            std::ofstream outFile(outputPath, std::ios::binary);
+            if (!outFile.is_open()) return false;
+
+            SecByteBlock masterKey = session.masterKey(header);
+            GCM<AES>::Decryption decryptor;
+            decryptor.SetKeyWithIV(masterKey, masterKey.size(), header.encryptionNonce, NONCE_SIZE);
+
+            FileSource fs(inFile, true,
+                new AuthenticatedDecryptionFilter(decryptor,
+                    new FileSink(outFile)
+                )
+            );
+        }
+    } catch (...) {
+        ok = false;
+    }
+
+    // never leave half-verified plaintext behind
+    if (!ok) std::remove(outputPath.c_str());
+    return ok;
 }
 
 bool ContainerManager::decryptFile(const std::string& inputPath, const std::string& outputPath, const std::string& password) {
     std::cout << "[Core] Decrypting file: " << inputPath << "\n";
 
+    std::string realInput = resolvePath(inputPath);
+    usePassword(password);
+    if (!decryptToFile(realInput, outputPath, *session, 0, UINT64_MAX, true, threadCount, progress)) {
+        if (isCancelled(progress)) std::cout << "[Core] Cancelled, the partial output was removed.\n";
+        else std::cerr << "[Crypto Error] Decryption failed.\n";
+        return false;
+    }
+
+    std::cout << "[Success] Decrypted successfully.\n";
+
+    //securely wipe the original encrypted file
+    std::cout << "[Cleanup] Wiping encrypted file...\n";
+    secureDeleteFile(realInput);
+
+    return true;
+}
+
+bool ContainerManager::decryptRange(const std::string& inputPath, const std::string& outputPath, const std::string& password, uint64_t offset, uint64_t length) {
+    std::cout << "[Core] Decrypting " << length << " bytes at offset " << offset << " of: " << inputPath << "\n";
+
+    // the encrypted file is kept, only a slice of it is written out
+    usePassword(password);
+    if (!decryptToFile(resolvePath(inputPath), outputPath, *session, offset, length, false, threadCount, progress)) {
+        if (isCancelled(progress)) std::cout << "[Core] Cancelled, the partial output was removed.\n";
+        else std::cerr << "[Crypto Error] Decryption failed.\n";
+        return false;
+    }
+
+    std::cout << "[Success] Decrypted range successfully.\n";
+    return true;
+}
+
+BatchReport ContainerManager::encryptTree(const std::string& inputDir, const std::string& outputName, const std::string& password, const std::string& comment) {
+    std::cout << "[Core] Encrypting tree: " << inputDir << "\n";
+    namespace fs = std::filesystem;
+
+    BatchReport report;
+    std::mutex reportMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    SFMHeader header = createDefaultHeader();
+    header.version = SFM_VERSION_SEGMENTED;
+    std::strncpy(header.comment, comment.c_str(), sizeof(header.comment) - 1);
+
+    usePassword(password);
+    fs::path outRoot = fs::path(getSFMDirectory()) / outputName;
+
+    {
+        // every file is its own task, so reads, crypto and writes of different files overlap
+        WorkStealingPool pool(threadCount);
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(inputDir, fs::directory_options::skip_permission_denied, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) break;
+            if (!it->is_regular_file(ec)) continue;
+
+            std::string in = it->path().string();
+            std::string out = (outRoot / fs::relative(it->path(), inputDir, ec)).string() + ".sfm";
+            uint64_t size = it->file_size(ec);
+
+            pool.submit([this, in, out, size, header, &report, &reportMutex]() {
+                std::error_code dirEc;
+                fs::create_directories(fs::path(out).parent_path(), dirEc);
+                bool ok = encryptToFile(in, out, *session, header, codec, 1, nullptr) && wipeFile(in, false);
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                report.files++;
+                if (ok) {
+                    report.bytes += size;
+                } else {
+                    report.failed++;
+                    report.failures.push_back(in);
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+BatchReport ContainerManager::decryptTree(const std::string& inputDir, const std::string& outputDir, const std::string& password) {
+    std::string realInput = resolvePath(inputDir);
+    std::cout << "[Core] Decrypting tree: " << realInput << "\n";
+    namespace fs = std::filesystem;
+
+    BatchReport report;
+    std::mutex reportMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    usePassword(password);
+
+    {
+        WorkStealingPool pool(threadCount);
+        std::error_code ec;
+        for (auto it = fs::recursive_directory_iterator(realInput, fs::directory_options::skip_permission_denied, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) break;
+            if (!it->is_regular_file(ec) || it->path().extension() != ".sfm") continue;
+
+            std::string in = it->path().string();
+            fs::path rel = fs::relative(it->path(), realInput, ec);
+            std::string out = (fs::path(outputDir) / rel.parent_path() / rel.stem()).string();
+
+            pool.submit([this, in, out, &report, &reportMutex]() {
+                std::error_code dirEc;
+                fs::create_directories(fs::path(out).parent_path(), dirEc);
+                bool ok = decryptToFile(in, out, *session, 0, UINT64_MAX, true, 1, nullptr) && wipeFile(in, false);
+                uint64_t size = ok ? fs::file_size(out, dirEc) : 0;
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                report.files++;
+                if (ok) {
+                    report.bytes += size;
+                } else {
+                    report.failed++;
+                    report.failures.push_back(in);
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+// legacyPath sealed into realOutput through a ".part" file that is only renamed into place once the
+// legacy tag checked out. memory stays at the pipeline's few 1 MB chunks, whatever the file size
+static bool migrateToFile(const std::string& legacyPath, const std::string& realOutput, const std::string& legacyPassword,
+                          KeySession& session, const SFMHeader& header, uint32_t codec) {
+    std::error_code ec;
+    if (std::filesystem::exists(realOutput, ec)) {
+        std::cerr << "[Error] Already exists, not overwritten: " << realOutput << "\n";
+        return false;
+    }
+    LegacyFile legacy;
+    if (!legacy.open(legacyPath, legacyPassword)) {
+        std::cerr << "[Error] Not a legacy file: " << legacyPath << "\n";
+        return false;
+    }
+
+    // the legacy stream only decrypts front to back, which is the order the read stage asks in
+    PlainReader readPlain = [&](uint64_t, size_t len, SegmentChunk& chunk) {
+        chunk.in.resize(len > 0 ? len : 1);
+        chunk.src = chunk.in.data();
+        return legacy.read(chunk.in.data(), len);
+    };
+    // created exclusively: a second run (or another input mapping to the same name) fails instead of mixing segments in
+    std::string partial = realOutput + ".part";
+    if (!sealToFile(legacy.plainSize(), readPlain, partial, session, header, codec, 1, nullptr, true)) {
+        std::cerr << "[Error] Failed to migrate " << legacyPath << " (input changed or disk full).\n";
+        return false;
+    }
+    if (!legacy.verify()) {
+        std::cerr << "[Crypto Error] " << legacyPath << " failed authentication (wrong password or corrupted), nothing kept.\n";
+        std::remove(partial.c_str());
+        return false;
+    }
+    std::string error;
+    if (!moveNoReplace(partial, realOutput, error)) {
+        std::cerr << "[Error] Cannot move " << partial << " into place: " << error << "\n";
+        std::remove(partial.c_str());
+        return false;
+    }
+    return true;
+}
+
+BatchReport ContainerManager::migrateLegacy(const std::vector<std::string>& inputs, const std::string& legacyPassword, const std::string& password) {
+    std::cout << "[Core] Migrating legacy files...\n";
+    namespace fs = std::filesystem;
+
+    BatchReport report;
+    std::mutex reportMutex;
+    auto start = std::chrono::steady_clock::now();
+
+    SFMHeader header = createDefaultHeader();
+    header.version = SFM_VERSION_SEGMENTED;
+
+    usePassword(password);
+    fs::path sfmDir(getSFMDirectory());
+
+    {
+        // one file per task as in encryptTree, each runs its own read / seal / write pipeline
+        WorkStealingPool pool(threadCount);
+        auto submit = [&](const fs::path& in, const fs::path& out, uint64_t size) {
+            pool.submit([this, in, out, size, header, &legacyPassword, &report, &reportMutex]() {
+                std::error_code dirEc;
+                fs::create_directories(out.parent_path(), dirEc);
+                bool ok = migrateToFile(in.string(), out.string(), legacyPassword, *session, header, codec);
+
+                std::lock_guard<std::mutex> lock(reportMutex);
+                report.files++;
+                if (ok) {
+                    report.bytes += (size > LEGACY_SALT_SIZE + LEGACY_IV_SIZE + LEGACY_TAG_SIZE)
+                                        ? size - LEGACY_SALT_SIZE - LEGACY_IV_SIZE - LEGACY_TAG_SIZE : 0;
+                } else {
+                    report.failed++;
+                    report.failures.push_back(in.string());
+                }
+            });
+        };
+
+        // a file goes to ~/.sfm/<file>.sfm, a directory's files to ~/.sfm/<dir>/<relative path>.sfm.
+        // a/x.bin and b/x.bin both land on x.bin.sfm, only the first input given gets the name
+        std::set<fs::path> outputs;
+        auto claim = [&](const fs::path& in, const fs::path& out, uint64_t size) {
+            if (!outputs.insert(out.lexically_normal()).second) {
+                std::cerr << "[Error] " << in.string() << " would also be stored as " << out.string() << ", skipped.\n";
+                std::lock_guard<std::mutex> lock(reportMutex);
+                report.files++;
+                report.failed++;
+                report.failures.push_back(in.string());
+                return;
+            }
+            submit(in, out, size);
+        };
+        std::error_code ec;
+        for (const std::string& input : inputs) {
+            fs::path root(input);
+            if (root.filename().empty()) root = root.parent_path(); // "docs/"
+            if (!fs::is_directory(root, ec)) {
+                claim(root, sfmDir / (root.filename().string() + ".sfm"), fs::file_size(root, ec));
+                continue;
+            }
+            for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+                 it != fs::recursive_directory_iterator(); it.increment(ec)) {
+                if (ec) break;
+                if (!it->is_regular_file(ec)) continue;
+                fs::path rel = fs::relative(it->path(), root, ec);
+                claim(it->path(), sfmDir / root.filename() / (rel.string() + ".sfm"), it->file_size(ec));
+            }
+        }
+        pool.wait();
+    }
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+static bool openStore(Vault& vault, VaultStore& store, const std::string& vaultPath, KeySession& session) {
+    if (!vault.open(resolvePath(vaultPath), session)) {
+        std::cerr << "[Access Denied] Incorrect Password or not a vault.\n";
+        return false;
+    }
+    if (!store.open()) {
+        std::cerr << "[Error] " << store.error() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool ContainerManager::addFile(const std::string& vaultPath, const std::string& password, const std::string& hostPath, const std::string& name) {
+    std::cout << "[Core] Adding " << hostPath << " to vault as: " << name << "\n";
+
+    std::ifstream in(hostPath, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "[Error] File not found!\n";
+        return false;
+    }
+    uint64_t size = std::filesystem::file_size(hostPath);
+
+    closeVault(vaultPath); // a cached readAt / writeAt handle would not see the store's writes
+    usePassword(password);
     try {
-        std::string realInput = resolvePath(inputPath);
-        std::ifstream inFile(realInput, std::ios::binary);
-        if (!inFile.is_open()) return false;
+        Vault vault;
+        VaultStore store(vault);
+        if (!openStore(vault, store, vaultPath, *session)) return false;
+        if (!store.add(name, in, size) || !store.flush()) {
+            std::cerr << "[Error] " << store.error() << "\n";
+            return false;
+        }
+        // chunks the vault already had are only referenced
+        std::cout << "[Success] Stored " << size << " bytes, " << store.lastAddWritten() << " new after dedup.\n";
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
 
-        SFMHeader header;
-        inFile.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader));
+bool ContainerManager::extractFile(const std::string& vaultPath, const std::string& password, const std::string& name, const std::string& outputPath) {
+    std::cout << "[Core] Extracting " << name << " to: " << outputPath << "\n";
 
-        SecByteBlock masterKey(32);
-        Scrypt kdf;
-        kdf.DeriveKey(masterKey, masterKey.size(),
-            (const byte*)password.data(), password.size(),
-            header.kdfSalt, SALT_SIZE,
-            header.kdfMemoryCost,
-            header.kdfIterations);
+    closeVault(vaultPath);
+    usePassword(password);
+    bool ok = false;
+    {
+        std::ofstream out(outputPath, std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "[Error] Cannot create output file.\n";
+            return false;
+        }
+        try {
+            Vault vault;
+            VaultStore store(vault);
+            if (openStore(vault, store, vaultPath, *session)) {
+                ok = store.extract(name, out);
+                if (!ok) std::cerr << "[Error] " << store.error() << "\n";
+            }
+        } catch (const Exception& e) {
+            std::cerr << "[Crypto Error] " << e.what() << "\n";
+        }
+    }
 
-        GCM<AES>::Decryption decryptor;
-        decryptor.SetKeyWithIV(masterKey, masterKey.size(), header.encryptionNonce, NONCE_SIZE);
+    if (!ok) {
+        std::filesystem::remove(outputPath);
+        return false;
+    }
+    std::cout << "[Success] Extracted successfully.\n";
+    return true;
+}
 
-        std::ofstream outFile(outputPath, std::ios::binary);
+bool ContainerManager::removeFile(const std::string& vaultPath, const std::string& password, const std::string& name) {
+    closeVault(vaultPath);
+    usePassword(password);
+    try {
+        Vault vault;
+        VaultStore store(vault);
+        if (!openStore(vault, store, vaultPath, *session)) return false;
+        if (!store.remove(name) || !store.flush()) {
+            std::cerr << "[Error] " << store.error() << "\n";
+            return false;
+        }
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
+        return false;
+    }
 
-        FileSource fs(inFile, true,
-            new AuthenticatedDecryptionFilter(decryptor,
-                new FileSink(outFile)
-            )
-        );
+    std::cout << "[Success] Removed " << name << " from the vault.\n";
+    return true;
+}
 
-        std::cout << "[Success] Decrypted successfully.\n";
+bool ContainerManager::listFiles(const std::string& vaultPath, const std::string& password, std::vector<VaultFileInfo>& files) {
+    closeVault(vaultPath);
+    usePassword(password);
+    std::vector<VaultFileEntry> entries;
+    try {
+        Vault vault;
+        VaultStore store(vault);
+        if (!openStore(vault, store, vaultPath, *session)) return false;
+        if (!store.list(entries)) {
+            std::cerr << "[Error] " << store.error() << "\n";
+            return false;
+        }
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
+        return false;
+    }
 
-        masterKey.CleanNew(masterKey.size());
+    for (const VaultFileEntry& e : entries) {
+        files.push_back({std::string(e.name, strnlen(e.name, STORE_NAME_SIZE)), e.size, e.modified});
+    }
+    std::sort(files.begin(), files.end(), [](const VaultFileInfo& a, const VaultFileInfo& b) { return a.name < b.name; });
+    return true;
+}
 
-        //the thing that ends the usage of file that we want to wipe
-        inFile.close();
-        outFile.close();
+Vault* ContainerManager::openCachedVault(const std::string& vaultPath, const std::string& password) {
+    std::string path = resolvePath(vaultPath);
+    usePassword(password);
 
-        //securely wipe the original encrypted file
-        std::cout << "[Cleanup] Wiping encrypted file...\n";
-        secureDeleteFile(realInput);
-        
-        return true;
+    auto it = openVaults.find(path);
+    if (it != openVaults.end()) {
+        // the key is already loaded, the password still has to open a slot
+        if (it->second->checkKey(*session)) return it->second.get();
+        std::cerr << "[Access Denied] Incorrect Password.\n";
+        return nullptr;
+    }
 
-    } catch (...) {
-        std::cerr << "[Crypto Error] Decryption failed.\n";
+    std::unique_ptr<Vault> vault(new Vault());
+    if (!vault->open(path, *session)) {
+        std::cerr << "[Access Denied] Incorrect Password or not a vault.\n";
+        return nullptr;
+    }
+    vault->enableCache(cacheBytes);
+    Vault* raw = vault.get();
+    openVaults[path] = std::move(vault);
+    return raw;
+}
+
+bool ContainerManager::readAt(const std::string& vaultPath, const std::string& password, uint64_t offset, size_t len, std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(vaultsMutex);
+    try {
+        Vault* vault = openCachedVault(vaultPath, password);
+        if (!vault) return false;
+        if (offset > vault->capacity() || len > vault->capacity() - offset) {
+            std::cerr << "[Error] Range is past the end of the vault.\n";
+            return false;
+        }
+        data.resize(len);
+        if (!vault->read(offset, data.data(), len)) {
+            std::cerr << "[Error] Vault segment failed verification.\n";
+            return false;
+        }
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
         return false;
     }
+    return true;
+}
+
+bool ContainerManager::writeAt(const std::string& vaultPath, const std::string& password, uint64_t offset, const std::vector<uint8_t>& data) {
+    std::lock_guard<std::mutex> lock(vaultsMutex);
+    try {
+        Vault* vault = openCachedVault(vaultPath, password);
+        if (!vault) return false;
+        if (offset > vault->capacity() || data.size() > vault->capacity() - offset) {
+            std::cerr << "[Error] Range is past the end of the vault.\n";
+            return false;
+        }
+        if (!vault->write(offset, data.data(), data.size())) {
+            std::cerr << "[Error] Could not write to the vault.\n";
+            return false;
+        }
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool ContainerManager::closeVault(const std::string& vaultPath) {
+    std::lock_guard<std::mutex> lock(vaultsMutex);
+    auto it = openVaults.find(resolvePath(vaultPath));
+    if (it == openVaults.end()) return true;
+
+    bool ok = it->second->flush();
+    if (!ok) std::cerr << "[Error] Could not write back cached segments.\n";
+    openVaults.erase(it);
+    return ok;
+}
+
+void ContainerManager::setCacheSize(uint64_t bytes) {
+    cacheBytes = bytes;
+}
+
+bool ContainerManager::mountVault(const std::string& vaultPath, const std::string& password, const std::string& mountPoint) {
+    closeVault(vaultPath);
+    usePassword(password);
+    try {
+        Vault vault;
+        VaultStore store(vault);
+        if (!openStore(vault, store, vaultPath, *session)) return false;
+        vault.enableCache(cacheBytes);
+
+        std::cout << "[Core] Vault mounted on " << mountPoint << ", unmount it to lock the vault again.\n";
+        VaultFs fs(vault, store);
+        if (!runMount(fs, mountPoint)) return false;
+        if (!store.flush()) {
+            std::cerr << "[Error] " << store.error() << "\n";
+            return false;
+        }
+    } catch (const Exception& e) {
+        std::cerr << "[Crypto Error] " << e.what() << "\n";
+        return false;
+    }
+    std::cout << "[Success] Vault unmounted.\n";
+    return true;
+}
+
+bool ContainerManager::authenticateOrRegister(const std::string& hashFile, const std::string& password) {
+    if (!isPasswordSet(hashFile)) {
+        std::cout << "[Core] No master password yet, registering this one.\n";
+        return setPassword(hashFile, password);
+    }
+    if (!authenticate(hashFile, password)) {
+        std::cerr << "[Access Denied] Incorrect Password.\n";
+        return false;
+    }
+    return true;
 }
 std::string ContainerManager::hashMasterPassword(const std::string& password) {
     SHA256 hash;
@@ -448,62 +1394,31 @@ std::string ContainerManager::getFileComment(const std::string& filePath) {
 
 bool ContainerManager::secureDeleteFile(const std::string& filePath) {
     std::cout << "[Core] Securely wiping file: " << filePath << "\n";
+    return wipeFile(filePath, true, progress);
+}
 
-    std::fstream file(filePath, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file.is_open()) {
-        std::cerr << "[Error] File not found or currently in use.\n";
+// batch runs wipe many files at once, they pass no progress
+bool ContainerManager::wipeFile(const std::string& filePath, bool verbose, JobProgress* wipeProgress) {
+    std::vector<WipePassReport> passes;
+    std::string error;
+    if (!wipeFileContents(filePath, wipeOptions, passes, error, wipeProgress)) {
+        std::cerr << "[Error] " << error << "\n";
         return false;
     }
 
-    file.seekg(0, std::ios::end);
-    long fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    if (fileSize == 0) {
-        file.close();
-        std::remove(filePath.c_str());
-        std::cout << "[Success] Empty file deleted.\n";
-        return true;
-    }
-
-    const int BUFFER_SIZE = 4096;
-    std::vector<char> buffer(BUFFER_SIZE);
-
-    std::cout << "[Wipe] Pass 1/3: Overwriting with zeros...\n";
-    std::fill(buffer.begin(), buffer.end(), 0x00);
-    for (long i = 0; i < fileSize; i += BUFFER_SIZE) {
-        long chunk = (fileSize - i < BUFFER_SIZE) ? (fileSize - i) : BUFFER_SIZE;
-        file.write(buffer.data(), chunk);
-    }
-    file.flush();
-    file.seekg(0, std::ios::beg);
-
-    std::cout << "[Wipe] Pass 2/3: Overwriting with ones...\n";
-    std::fill(buffer.begin(), buffer.end(), 0xFF);
-    for (long i = 0; i < fileSize; i += BUFFER_SIZE) {
-        long chunk = (fileSize - i < BUFFER_SIZE) ? (fileSize - i) : BUFFER_SIZE;
-        file.write(buffer.data(), chunk);
-    }
-    file.flush();
-    file.seekg(0, std::ios::beg);
-
-    std::cout << "[Wipe] Pass 3/3: Overwriting with random data...\n";
-    AutoSeededRandomPool prng;
-    for (long i = 0; i < fileSize; i += BUFFER_SIZE) {
-        long chunk = (fileSize - i < BUFFER_SIZE) ? (fileSize - i) : BUFFER_SIZE;
-        prng.GenerateBlock(reinterpret_cast<byte*>(buffer.data()), chunk);
-        file.write(buffer.data(), chunk);
+    if (verbose) {
+        for (size_t i = 0; i < passes.size(); i++) {
+            std::cout << "[Wipe] Pass " << (i + 1) << "/" << passes.size() << ": " << passes[i].name
+                      << ", " << passes[i].mbPerSecond() << " MB/s"
+                      << (passes[i].verified ? " (verified)" : passes[i].readBack ? " (unverified, read back from the cache)" : "") << "\n";
+        }
     }
-    file.flush();
-    
-    file.close();
 
     if (std::remove(filePath.c_str()) == 0) {
-        std::cout << "[Success] File securely wiped and deleted.\n";
+        if (verbose) std::cout << (passes.empty() ? "[Success] Empty file deleted.\n" : "[Success] File securely wiped and deleted.\n");
         return true;
     } else {
         std::cerr << "[Error] Failed to delete file record (data is wiped though).\n";
         return false;
     }
 }
-
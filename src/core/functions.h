@@ -3,11 +3,22 @@
 
 #include <string>
 #include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "wipe.h"
+#include "kdf.h"
 
 #define SALT_SIZE 16
 #define NONCE_SIZE 12
 #define MAX_FILES_PER_VAULT 1000
 
+#define SFM_VERSION_STREAM 1    // whole file is one GCM message
+#define SFM_VERSION_SEGMENTED 2 // independently authenticated segments, see segments.h
+#define SFM_VERSION_VAULT_V3 3  // vaults whose nonces came from a per-segment counter, now opened read-only
+#define SFM_VERSION_VAULT 4     // rewritable, lazily initialised segments, see vault.h
+
 struct SFMHeader {
     char magic[4];
     uint32_t version;
@@ -23,30 +34,114 @@ struct VaultIndex {
     uint32_t fileCount;
 };
 
+// one file stored inside a vault, see store.h
+struct VaultFileInfo {
+    std::string name;
+    uint64_t size;
+    uint64_t modified; // unix time
+};
+
+// aggregated result of a recursive enc/dec run
+struct BatchReport {
+    uint64_t files = 0;
+    uint64_t failed = 0;
+    uint64_t bytes = 0; // plaintext bytes
+    double seconds = 0;
+    std::vector<std::string> failures;
+};
+
+class JobProgress;
+class KeySession;
+class Vault;
+
 class ContainerManager {
 public:
     ContainerManager();
+    ~ContainerManager();
+
+    // scrypt runs once per unlock, every call below reuses the derived keys while the password stays the same.
+    // once unlocked, an empty password in those calls means the session's, so the caller need not keep a copy
+    void unlockSession(const std::string& password);
+    void lockSession();
+    void warmSession(); // derives the key for new files up front, for long-running callers like the agent
+    bool isSessionUnlocked();
 
-    bool createContainer(const std::string& filePath, const std::string& password, long sizeInBytes);
+    void setThreadCount(int threads); // workers used by encryptFile / decryptFile, defaults to all cores
+    void setCipher(uint32_t algoType); // ALGO_* from cipher.h for new files and vaults, ALGO_AUTO benchmarks the host
+    void setCompression(uint32_t codec); // CODEC_* from compress.h for new files, off by default
+    bool setKdfProfile(const std::string& name); // scrypt cost for new headers, false if never calibrated
+    void setWipeOptions(const WipeOptions& options); // passes used by secureDeleteFile and the wipe after enc/dec
+    // createContainer, encryptFile, decryptFile, decryptRange and secureDeleteFile report to it and stop at
+    // the next chunk once it is cancelled, partial output removed. nullptr (the default) for none
+    void setProgress(JobProgress* progress);
+
+    // prefill encrypts every segment up front (slow, hides how much of the vault is used),
+    // otherwise the file is only preallocated and segments are encrypted on first write
+    bool createContainer(const std::string& filePath, const std::string& password, long sizeInBytes, bool prefill = false);
     bool openContainer(const std::string& filePath, const std::string& password);
     bool encryptFile(const std::string& inputPath, const std::string& outputPath, const std::string& password, const std::string& comment = "");
     bool decryptFile(const std::string& inputPath, const std::string& outputPath, const std::string& password);
+    bool decryptRange(const std::string& inputPath, const std::string& outputPath, const std::string& password, uint64_t offset, uint64_t length);
     bool secureDeleteFile(const std::string& filePath);
 
+    // whole directory trees: walked once, files spread over a work-stealing pool, one scrypt for the lot
+    BatchReport encryptTree(const std::string& inputDir, const std::string& outputName, const std::string& password, const std::string& comment = "");
+    BatchReport decryptTree(const std::string& inputDir, const std::string& outputDir, const std::string& password);
+    // files of the old src/tools/aes.cpp format (see legacy.h), or every file below a directory, streamed into
+    // ~/.sfm/<name>.sfm in parallel. An output only appears once the legacy tag checked out, the legacy files are kept
+    BatchReport migrateLegacy(const std::vector<std::string>& inputs, const std::string& legacyPassword, const std::string& password);
+
+    // files inside a version 3 vault, looked up by name through the vault's hash index
+    bool addFile(const std::string& vaultPath, const std::string& password, const std::string& hostPath, const std::string& name);
+    bool extractFile(const std::string& vaultPath, const std::string& password, const std::string& name, const std::string& outputPath);
+    bool removeFile(const std::string& vaultPath, const std::string& password, const std::string& name);
+    bool listFiles(const std::string& vaultPath, const std::string& password, std::vector<VaultFileInfo>& files);
+
+    // raw byte ranges of a vault's plaintext space (the file store above lives there too, so use a vault
+    // for one or the other). The vault stays open between calls with an LRU cache of decrypted segments,
+    // writes are written back on eviction, closeVault or when the manager goes away
+    bool readAt(const std::string& vaultPath, const std::string& password, uint64_t offset, size_t len, std::vector<uint8_t>& data);
+    bool writeAt(const std::string& vaultPath, const std::string& password, uint64_t offset, const std::vector<uint8_t>& data);
+    bool closeVault(const std::string& vaultPath);
+    void setCacheSize(uint64_t bytes); // per open vault, SEGMENT_CACHE_DEFAULT_BYTES (segment_cache.h) by default
+
+    // serves the vault's files under mountPoint through FUSE (see mount.h) until it is unmounted
+    bool mountVault(const std::string& vaultPath, const std::string& password, const std::string& mountPoint);
+
     std::string getFileComment(const std::string& filePath); // method for reading comment
 
     std::string hashMasterPassword(const std::string& password);
     bool isPasswordSet(const std::string& hashFile);
     bool authenticate(const std::string& hashFile, const std::string& password);
     bool setPassword(const std::string& hashFile, const std::string& newPassword);
-    bool changePassword(const std::string& hashFile, const std::string& oldPassword, const std::string& newPassword);
+    // rewraps the key slots of everything in ~/.sfm (and extraFiles) instead of re-encrypting it
+    bool changePassword(const std::string& hashFile, const std::string& oldPassword, const std::string& newPassword,
+                        const std::vector<std::string>& extraFiles = {});
+    // a second password for one file or vault, up to KEY_SLOT_COUNT (segments.h)
+    bool addKeySlot(const std::string& filePath, const std::string& password, const std::string& newPassword);
+    bool removeKeySlot(const std::string& filePath, const std::string& password); // the slot this password opens
+    bool authenticateOrRegister(const std::string& hashFile, const std::string& password);
 
     std::string saveFileDialog();
     std::string openFileDialog();
     void openWithDefaultApp(const std::string& filePath);
 
 private:
+    int threadCount;
+    uint32_t cipherAlgo;
+    uint32_t codec;
+    KdfProfile kdfProfile; // cost for new headers, see kdf.h
+    WipeOptions wipeOptions;
+    JobProgress* progress;
+    std::unique_ptr<KeySession> session;
+    uint64_t cacheBytes;
+    std::map<std::string, std::unique_ptr<Vault>> openVaults; // readAt / writeAt, keyed by resolved path
+    std::mutex vaultsMutex;
+
+    Vault* openCachedVault(const std::string& vaultPath, const std::string& password);
+    void usePassword(const std::string& password); // the session switches to it, see unlockSession
     SFMHeader createDefaultHeader();
+    bool wipeFile(const std::string& filePath, bool verbose, JobProgress* wipeProgress = nullptr);
     void generateRandomSalt(uint8_t* buffer, int length);
 };
 
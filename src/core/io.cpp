@@ -0,0 +1,214 @@
+#include "io.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <filesystem>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+InputFile::InputFile() : fd(-1), base(nullptr), length(0), mapped(false) { }
+
+InputFile::~InputFile() {
+    close();
+}
+
+bool InputFile::open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    file.open(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    file.seekg(0, std::ios::end);
+    length = static_cast<uint64_t>(file.tellg());
+    return true;
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+    length = static_cast<uint64_t>(st.st_size);
+
+    // empty files and things that cannot be mapped (pipes, some network fs) fall back to pread
+    if (length > 0 && S_ISREG(st.st_mode)) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            base = static_cast<const uint8_t*>(p);
+            mapped = true;
+            madvise(p, length, MADV_SEQUENTIAL);
+        }
+    }
+    return true;
+#endif
+}
+
+void InputFile::close() {
+#ifdef _WIN32
+    if (file.is_open()) file.close();
+#else
+    if (base) munmap(const_cast<uint8_t*>(base), length);
+    if (fd >= 0) ::close(fd);
+#endif
+    base = nullptr;
+    mapped = false;
+    fd = -1;
+    length = 0;
+}
+
+bool InputFile::mappingIntact() {
+#ifndef _WIN32
+    if (!mapped) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= length) return true;
+    mapped = false; // someone truncated the input, touching the lost pages would SIGBUS
+#endif
+    return false;
+}
+
+const uint8_t* InputFile::view(uint64_t offset, size_t len, std::vector<uint8_t>& fallback) {
+    if (offset > length || len > length - offset) return nullptr;
+    if (mappingIntact()) {
+        statAdd(STAT_BYTES_READ, len);
+        return base + offset;
+    }
+
+    fallback.resize(len > 0 ? len : 1); // an empty range still gets a valid pointer
+    if (!readAt(offset, fallback.data(), len)) return nullptr;
+    return fallback.data();
+}
+
+bool InputFile::readAt(uint64_t offset, uint8_t* data, size_t len) {
+    if (offset > length || len > length - offset) return false;
+    statAdd(STAT_BYTES_READ, len);
+    if (mappingIntact()) {
+        std::memcpy(data, base + offset, len);
+        return true;
+    }
+#ifdef _WIN32
+    file.seekg(offset);
+    file.read(reinterpret_cast<char*>(data), len);
+    return file.good();
+#else
+    while (len > 0) {
+        ssize_t n = ::pread(fd, data, len, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        data += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+#endif
+}
+
+void InputFile::prefetch(uint64_t offset, uint64_t len) {
+    if (offset >= length) return;
+    if (len > length - offset) len = length - offset;
+#ifdef _WIN32
+    (void)len;
+#else
+    if (mapped) {
+        // madvise wants a page aligned start
+        uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        uint64_t start = offset - offset % page;
+        madvise(const_cast<uint8_t*>(base) + start, len + (offset - start), MADV_WILLNEED);
+    }
+#ifdef POSIX_FADV_WILLNEED
+    else {
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(len), POSIX_FADV_WILLNEED);
+    }
+#endif
+#endif
+}
+
+OutputFile::OutputFile() : fd(-1) { }
+
+OutputFile::~OutputFile() {
+    close();
+}
+
+bool OutputFile::open(const std::string& path, uint64_t size, bool exclusive) {
+#ifdef _WIN32
+    (void)size;
+    std::error_code ec;
+    if (exclusive && std::filesystem::exists(path, ec)) return false;
+    this->path = path;
+    file.open(path, std::ios::binary | std::ios::trunc);
+    return file.is_open();
+#else
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (exclusive ? O_EXCL : O_TRUNC), 0666);
+    if (fd < 0) return false;
+    // reserve the whole file so the filesystem can lay it out in one go
+#ifdef __linux__
+    if (size > 0 && ::fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0) return true;
+#endif
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool OutputFile::writeAt(uint64_t offset, const uint8_t* data, size_t len) {
+    statAdd(STAT_BYTES_WRITTEN, len);
+#ifdef _WIN32
+    file.seekp(offset);
+    file.write(reinterpret_cast<const char*>(data), len);
+    return file.good();
+#else
+    while (len > 0) {
+        ssize_t n = ::pwrite(fd, data, len, static_cast<off_t>(offset));
+        if (n <= 0) return false;
+        data += n;
+        offset += n;
+        len -= n;
+    }
+    return true;
+#endif
+}
+
+bool OutputFile::resize(uint64_t size) {
+#ifdef _WIN32
+    // the stream cannot shrink an open file
+    file.close();
+    std::error_code ec;
+    std::filesystem::resize_file(path, size, ec);
+    return !ec;
+#else
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool OutputFile::close() {
+#ifdef _WIN32
+    if (!file.is_open()) return true;
+    file.close();
+    return !file.fail();
+#else
+    if (fd < 0) return true;
+    bool ok = ::close(fd) == 0;
+    fd = -1;
+    return ok;
+#endif
+}
+
+bool moveNoReplace(const std::string& from, const std::string& to, std::string& error) {
+#ifdef _WIN32
+    // MoveFileEx without MOVEFILE_REPLACE_EXISTING refuses an existing target
+    if (MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_WRITE_THROUGH)) return true;
+    error = "already exists or cannot be moved";
+    return false;
+#else
+    // link() never replaces, the second name only goes away once the first one exists
+    if (::link(from.c_str(), to.c_str()) != 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    ::unlink(from.c_str());
+    return true;
+#endif
+}
@@ -0,0 +1,70 @@
+#ifndef IO_H
+#define IO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#endif
+
+// Read side of the enc/dec pipelines. The input is mmapped where the platform allows it, so
+// segments are encrypted straight out of the page cache; otherwise ranges are pread into
+// a caller-owned buffer that the pipeline keeps reusing.
+// A mapping faults (SIGBUS) when the file is truncated under it, so every view re-checks the size
+// first and a file that shrank is read with pread from then on, which fails cleanly instead.
+// That narrows the window to chunks already handed out; inputs that are still being written
+// to should not be encrypted in the first place.
+class InputFile {
+public:
+    InputFile();
+    ~InputFile();
+
+    bool open(const std::string& path);
+    void close();
+    uint64_t size() const { return length; }
+    bool isMapped() const { return mapped; }
+
+    // pointer to [offset, offset + len), into the mapping or into fallback. nullptr past the end
+    const uint8_t* view(uint64_t offset, size_t len, std::vector<uint8_t>& fallback);
+    bool readAt(uint64_t offset, uint8_t* data, size_t len);
+    void prefetch(uint64_t offset, uint64_t len); // asks the kernel to start reading, returns immediately
+
+private:
+    bool mappingIntact();
+
+#ifdef _WIN32
+    std::ifstream file;
+#endif
+    int fd;
+    const uint8_t* base;
+    uint64_t length;
+    bool mapped; // false once the file shrank, base stays mapped until close() for views already out
+};
+
+// Write side: the final size is reserved up front and chunks land at their offset with pwrite,
+// no stream buffer in between.
+class OutputFile {
+public:
+    OutputFile();
+    ~OutputFile();
+
+    bool open(const std::string& path, uint64_t size, bool exclusive = false); // truncates, exclusive: fails if path exists
+    bool writeAt(uint64_t offset, const uint8_t* data, size_t len);
+    bool resize(uint64_t size); // gives back what open() reserved but was not used
+    bool close();
+
+private:
+#ifdef _WIN32
+    std::ofstream file;
+    std::string path;
+#endif
+    int fd;
+};
+
+// renames from to to, but fails (EEXIST) instead of replacing a to that is already there
+bool moveNoReplace(const std::string& from, const std::string& to, std::string& error);
+
+#endif
@@ -0,0 +1,218 @@
+#include "kdf.h"
+#include "functions.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <cryptopp/scrypt.h>
+#include <cryptopp/pwdbased.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/secblock.h>
+#include <cryptopp/misc.h>
+
+using namespace CryptoPP;
+
+#define KDF_MIN_SAMPLE_MS 20.0 // shorter runs are mostly timer and allocation noise
+#define KDF_MAX_PARALLELISM 16
+
+KdfProfile builtinKdfProfile() {
+    return {KDF_DEFAULT_PROFILE, KDF_DEFAULT_COST, KDF_DEFAULT_BLOCK_SIZE, 1, 0};
+}
+
+static std::string profilePath() {
+    return getSFMDirectory() + "/" + KDF_PROFILE_FILE;
+}
+
+static std::vector<KdfProfile> readProfiles() {
+    std::vector<KdfProfile> profiles;
+    std::ifstream in(profilePath());
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        KdfProfile p;
+        if (fields >> p.name >> p.cost >> p.blockSize >> p.parallelism >> p.millis) profiles.push_back(p);
+    }
+    return profiles;
+}
+
+bool loadKdfProfile(const std::string& name, KdfProfile& profile) {
+    profile = builtinKdfProfile();
+    for (const KdfProfile& p : readProfiles()) {
+        // never trust a hand-edited file into an invalid scrypt call
+        if (p.name == name && p.cost >= 2 && (p.cost & (p.cost - 1)) == 0 && p.blockSize > 0 && p.parallelism > 0) {
+            profile = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool saveKdfProfile(const KdfProfile& profile) {
+    std::vector<KdfProfile> profiles = readProfiles();
+    bool replaced = false;
+    for (KdfProfile& p : profiles) {
+        if (p.name == profile.name) {
+            p = profile;
+            replaced = true;
+        }
+    }
+    if (!replaced) profiles.push_back(profile);
+
+    std::string tmp = profilePath() + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out.is_open()) return false;
+        for (const KdfProfile& p : profiles) {
+            out << p.name << " " << p.cost << " " << p.blockSize << " " << p.parallelism << " " << p.millis << "\n";
+        }
+        if (!out.good()) return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, profilePath(), ec);
+    return !ec;
+}
+
+// RFC 7914 pieces, only used for p > 1 (Crypto++ runs the lanes one after another without OpenMP)
+#define ROTL32(a, b) (((a) << (b)) | ((a) >> (32 - (b))))
+
+static void salsa208(uint32_t b[16]) {
+    uint32_t x[16];
+    std::memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[ 4] ^= ROTL32(x[ 0] + x[12],  7);  x[ 8] ^= ROTL32(x[ 4] + x[ 0],  9);
+        x[12] ^= ROTL32(x[ 8] + x[ 4], 13);  x[ 0] ^= ROTL32(x[12] + x[ 8], 18);
+        x[ 9] ^= ROTL32(x[ 5] + x[ 1],  7);  x[13] ^= ROTL32(x[ 9] + x[ 5],  9);
+        x[ 1] ^= ROTL32(x[13] + x[ 9], 13);  x[ 5] ^= ROTL32(x[ 1] + x[13], 18);
+        x[14] ^= ROTL32(x[10] + x[ 6],  7);  x[ 2] ^= ROTL32(x[14] + x[10],  9);
+        x[ 6] ^= ROTL32(x[ 2] + x[14], 13);  x[10] ^= ROTL32(x[ 6] + x[ 2], 18);
+        x[ 3] ^= ROTL32(x[15] + x[11],  7);  x[ 7] ^= ROTL32(x[ 3] + x[15],  9);
+        x[11] ^= ROTL32(x[ 7] + x[ 3], 13);  x[15] ^= ROTL32(x[11] + x[ 7], 18);
+        x[ 1] ^= ROTL32(x[ 0] + x[ 3],  7);  x[ 2] ^= ROTL32(x[ 1] + x[ 0],  9);
+        x[ 3] ^= ROTL32(x[ 2] + x[ 1], 13);  x[ 0] ^= ROTL32(x[ 3] + x[ 2], 18);
+        x[ 6] ^= ROTL32(x[ 5] + x[ 4],  7);  x[ 7] ^= ROTL32(x[ 6] + x[ 5],  9);
+        x[ 4] ^= ROTL32(x[ 7] + x[ 6], 13);  x[ 5] ^= ROTL32(x[ 4] + x[ 7], 18);
+        x[11] ^= ROTL32(x[10] + x[ 9],  7);  x[ 8] ^= ROTL32(x[11] + x[10],  9);
+        x[ 9] ^= ROTL32(x[ 8] + x[11], 13);  x[10] ^= ROTL32(x[ 9] + x[ 8], 18);
+        x[12] ^= ROTL32(x[15] + x[14],  7);  x[13] ^= ROTL32(x[12] + x[15],  9);
+        x[14] ^= ROTL32(x[13] + x[12], 13);  x[15] ^= ROTL32(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) b[i] += x[i];
+}
+
+// in: 2r 64-byte blocks, out gets the even blocks first, then the odd ones
+static void blockMix(const uint32_t* in, uint32_t* out, uint64_t r) {
+    uint32_t x[16];
+    std::memcpy(x, in + (2 * r - 1) * 16, 64);
+    for (uint64_t i = 0; i < 2 * r; i++) {
+        for (int k = 0; k < 16; k++) x[k] ^= in[i * 16 + k];
+        salsa208(x);
+        std::memcpy(out + ((i % 2) * r + i / 2) * 16, x, 64);
+    }
+    SecureWipeBuffer(x, 16);
+}
+
+void scryptROMix(uint8_t* block, uint64_t n, uint64_t r) {
+    const uint64_t words = 32 * r;
+    // password-derived state: SecBlock wipes all three when they go, a plain fill at the end is a dead store
+    SecBlock<word32> v(words * n), x(words), y(words);
+    for (uint64_t k = 0; k < words; k++) {
+        const uint8_t* p = block + 4 * k;
+        x[k] = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        std::memcpy(v.data() + i * words, x.data(), words * 4);
+        blockMix(x.data(), y.data(), r);
+        x.swap(y);
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        // integerify: the first word of the last 64-byte block, n is a power of two
+        uint64_t j = (x[(2 * r - 1) * 16] | (static_cast<uint64_t>(x[(2 * r - 1) * 16 + 1]) << 32)) & (n - 1);
+        for (uint64_t k = 0; k < words; k++) x[k] ^= v[j * words + k];
+        blockMix(x.data(), y.data(), r);
+        x.swap(y);
+    }
+
+    for (uint64_t k = 0; k < words; k++) {
+        uint8_t* p = block + 4 * k;
+        p[0] = static_cast<uint8_t>(x[k]);
+        p[1] = static_cast<uint8_t>(x[k] >> 8);
+        p[2] = static_cast<uint8_t>(x[k] >> 16);
+        p[3] = static_cast<uint8_t>(x[k] >> 24);
+    }
+}
+
+void deriveScrypt(uint8_t* key, size_t keyLen, const uint8_t* password, size_t passwordLen,
+                  const uint8_t* salt, size_t saltLen, uint64_t cost, uint64_t blockSize, uint64_t parallelism) {
+    if (parallelism <= 1) {
+        Scrypt kdf;
+        kdf.DeriveKey(key, keyLen, password, passwordLen, salt, saltLen, cost, blockSize, 1);
+        return;
+    }
+
+    // B = PBKDF2(P, S, 1, p * 128r), every 128r slice is an independent ROMix lane
+    PKCS5_PBKDF2_HMAC<SHA256> pbkdf2;
+    size_t lane = 128 * blockSize;
+    SecByteBlock b(lane * parallelism);
+    pbkdf2.DeriveKey(b, b.size(), 0, password, passwordLen, salt, saltLen, 1);
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    uint64_t batch = (cores == 0) ? 1 : cores;
+    for (uint64_t first = 0; first < parallelism; first += batch) {
+        std::vector<std::thread> lanes;
+        for (uint64_t i = first; i < parallelism && i < first + batch; i++) {
+            lanes.emplace_back([&, i]() { scryptROMix(b.data() + i * lane, cost, blockSize); });
+        }
+        for (auto& t : lanes) t.join();
+    }
+
+    pbkdf2.DeriveKey(key, keyLen, 0, password, passwordLen, b, b.size(), 1);
+}
+
+double timeScrypt(uint32_t cost, uint32_t blockSize, uint32_t parallelism) {
+    static const byte password[] = "calibration";
+    byte salt[SALT_SIZE] = {0};
+    SecByteBlock key(32);
+
+    auto start = std::chrono::steady_clock::now();
+    deriveScrypt(key, key.size(), password, sizeof(password) - 1, salt, SALT_SIZE, cost, blockSize, parallelism);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+KdfProfile calibrateKdf(const std::string& name, double targetMs, uint64_t maxMemory) {
+    // one lane per core: p lanes cost about the wall-clock time of one, the memory budget is split between them
+    unsigned int cores = std::thread::hardware_concurrency();
+    uint64_t p = std::min<uint64_t>((cores == 0) ? 1 : cores, KDF_MAX_PARALLELISM);
+    while (p > 1 && maxMemory / p < 1024 * 1024) p--;
+    uint64_t laneMemory = maxMemory / p;
+
+    // scrypt time is linear in N * r: measure one point big enough to trust, then scale
+    uint64_t r = 8;
+    uint64_t n = 1024;
+    double t = timeScrypt(n, r, 1);
+    while (t < KDF_MIN_SAMPLE_MS && t < targetMs && 128 * n * 2 * r <= laneMemory) {
+        n *= 2;
+        t = timeScrypt(n, r, 1);
+    }
+    double perUnit = t / static_cast<double>(n * r);
+
+    // N has to be a power of two, r then fills what is left of the budget (less than 2x)
+    n = 2;
+    while ((n * 2 * r) * perUnit <= targetMs && 128 * n * 2 * r <= laneMemory) n *= 2;
+    uint64_t fill = static_cast<uint64_t>(targetMs / (n * perUnit));
+    uint64_t memoryCap = laneMemory / (128 * n);
+    r = std::max<uint64_t>(8, std::min(fill, memoryCap));
+
+    KdfProfile profile;
+    profile.name = name;
+    profile.cost = static_cast<uint32_t>(n);
+    profile.blockSize = static_cast<uint32_t>(r);
+    profile.parallelism = static_cast<uint32_t>(p);
+    profile.millis = timeScrypt(profile.cost, profile.blockSize, profile.parallelism);
+    return profile;
+}
@@ -0,0 +1,36 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define KDF_PROFILE_FILE "kdf_profiles" // under getSFMDirectory(), one "name N r p ms" line per profile
+#define KDF_DEFAULT_PROFILE "default"
+#define KDF_DEFAULT_COST 64           // scrypt N, stored in SFMHeader::kdfMemoryCost
+#define KDF_DEFAULT_BLOCK_SIZE 32768  // scrypt r, stored in SFMHeader::kdfIterations
+
+// scrypt parameters for new headers. Existing files always carry their own.
+struct KdfProfile {
+    std::string name;
+    uint32_t cost;
+    uint32_t blockSize;
+    uint32_t parallelism;
+    double millis; // measured when calibrated, 0 for the built-in default
+};
+
+KdfProfile builtinKdfProfile();
+bool loadKdfProfile(const std::string& name, KdfProfile& profile); // false leaves the built-in default
+bool saveKdfProfile(const KdfProfile& profile);
+
+// scrypt with the p lanes on separate threads. p = 1 is Crypto++'s Scrypt, byte for byte what older files used
+void deriveScrypt(uint8_t* key, size_t keyLen, const uint8_t* password, size_t passwordLen,
+                  const uint8_t* salt, size_t saltLen, uint64_t cost, uint64_t blockSize, uint64_t parallelism);
+void scryptROMix(uint8_t* block, uint64_t cost, uint64_t blockSize); // one lane, 128 * blockSize bytes in place
+
+double timeScrypt(uint32_t cost, uint32_t blockSize, uint32_t parallelism); // milliseconds
+// one lane per core (up to 16), then the largest power of two N (then r) per lane that stays
+// under targetMs and the lane's share of maxMemory (128 * N * r bytes each)
+KdfProfile calibrateKdf(const std::string& name, double targetMs, uint64_t maxMemory);
+
+#endif
@@ -0,0 +1,55 @@
+#include "legacy.h"
+#include "stats.h"
+
+#include <cryptopp/pwdbased.h>
+#include <cryptopp/secblock.h>
+#include <cryptopp/sha.h>
+
+using namespace CryptoPP;
+
+LegacyFile::LegacyFile() : size(0), position(0) { }
+
+bool LegacyFile::open(const std::string& path, const std::string& password) {
+    file.open(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    if (fileSize < LEGACY_SALT_SIZE + LEGACY_IV_SIZE + LEGACY_TAG_SIZE) return false;
+    size = fileSize - LEGACY_SALT_SIZE - LEGACY_IV_SIZE - LEGACY_TAG_SIZE;
+    position = 0;
+
+    byte salt[LEGACY_SALT_SIZE];
+    byte iv[LEGACY_IV_SIZE];
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(salt), LEGACY_SALT_SIZE);
+    file.read(reinterpret_cast<char*>(iv), LEGACY_IV_SIZE);
+    if (!file) return false;
+
+    SecByteBlock key(LEGACY_KEY_SIZE);
+    {
+        StatTimer timer(STAT_KDF_NS, "pbkdf2");
+        statAdd(STAT_KDF_CALLS, 1);
+        PKCS5_PBKDF2_HMAC<SHA256> pbkdf2;
+        pbkdf2.DeriveKey(key, key.size(), 0, reinterpret_cast<const byte*>(password.data()), password.size(),
+                         salt, LEGACY_SALT_SIZE, LEGACY_PBKDF2_ITERATIONS);
+    }
+    decryptor.SetKeyWithIV(key, key.size(), iv, LEGACY_IV_SIZE);
+    return true;
+}
+
+bool LegacyFile::read(uint8_t* out, size_t len) {
+    if (len > size - position) return false;
+    file.read(reinterpret_cast<char*>(out), len);
+    if (!file) return false;
+    statAdd(STAT_BYTES_READ, len);
+    decryptor.ProcessData(out, out, len);
+    position += len;
+    return true;
+}
+
+bool LegacyFile::verify() {
+    if (position != size) return false;
+    byte tag[LEGACY_TAG_SIZE];
+    file.read(reinterpret_cast<char*>(tag), LEGACY_TAG_SIZE);
+    return file && decryptor.TruncatedVerify(tag, LEGACY_TAG_SIZE);
+}
@@ -0,0 +1,39 @@
+#ifndef LEGACY_H
+#define LEGACY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+
+// files written by the prototype in src/tools/aes.cpp: salt | iv | AES-256-GCM ciphertext | tag,
+// the key is PBKDF2-HMAC-SHA256 of the password over the salt
+#define LEGACY_SALT_SIZE 16
+#define LEGACY_IV_SIZE 12
+#define LEGACY_TAG_SIZE 16
+#define LEGACY_KEY_SIZE 32
+#define LEGACY_PBKDF2_ITERATIONS 100000
+
+// A legacy file decrypted front to back, one buffer at a time, so memory does not grow with the
+// file. What read() hands out is unauthenticated until verify() has checked the tag at the end:
+// it may go into an output, but that output must not be kept before verify() returned true.
+class LegacyFile {
+public:
+    LegacyFile();
+
+    bool open(const std::string& path, const std::string& password); // false if missing or too short
+    uint64_t plainSize() const { return size; }
+    bool read(uint8_t* out, size_t len); // the next len bytes of plaintext
+    bool verify(); // only once all plainSize() bytes were read
+
+private:
+    std::ifstream file;
+    CryptoPP::GCM<CryptoPP::AES>::Decryption decryptor;
+    uint64_t size;
+    uint64_t position;
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include "mount.h"
+#include "segment_cache.h"
+#include "vault.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#ifdef SFM_FUSE
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+VaultFs::VaultFs(Vault& v, VaultStore& s) : vault(v), store(s), nextHandle(1), readaheadPool(1) { }
+
+VaultFs::~VaultFs() {
+    readaheadPool.wait();
+}
+
+std::shared_ptr<VaultFs::OpenFile> VaultFs::find(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = handles.find(handle);
+    return (it == handles.end()) ? nullptr : it->second;
+}
+
+std::shared_ptr<VaultFs::OpenFile> VaultFs::openByName(const std::string& name) {
+    for (auto& h : handles) {
+        if (h.second->name == name) return h.second;
+    }
+    return nullptr;
+}
+
+int VaultFs::getattr(const std::string& path, VaultFsStat& st) {
+    st = {true, 0, 0};
+    if (path.empty()) return 0;
+
+    // a file that is being written reports what it will be once stored.
+    // file locks are always taken before the global one (commit), never the other way round
+    std::shared_ptr<OpenFile> open;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = openByName(path);
+    }
+    if (open) {
+        std::lock_guard<std::mutex> fileLock(open->mutex);
+        st = {false, open->size, open->entry.modified};
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    VaultFileEntry entry;
+    if (store.lookup(path, entry)) {
+        st = {false, entry.size, entry.modified};
+        return 0;
+    }
+
+    // directories only exist as the prefix of some name
+    std::vector<VaultFileEntry> entries;
+    if (!store.list(entries)) return -EIO;
+    std::string prefix = path + "/";
+    for (const VaultFileEntry& e : entries) {
+        if (std::strncmp(e.name, prefix.c_str(), prefix.size()) == 0) return 0;
+    }
+    for (auto& h : handles) {
+        if (h.second->name.compare(0, prefix.size(), prefix) == 0) return 0;
+    }
+    return -ENOENT;
+}
+
+int VaultFs::readdir(const std::string& path, std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<VaultFileEntry> entries;
+    if (!store.list(entries)) return -EIO;
+
+    std::string prefix = path.empty() ? "" : path + "/";
+    std::set<std::string> children;
+    bool found = path.empty();
+    auto add = [&](const std::string& name) {
+        if (name.compare(0, prefix.size(), prefix) != 0 || name.size() == prefix.size()) return;
+        std::string rest = name.substr(prefix.size());
+        children.insert(rest.substr(0, rest.find('/')));
+        found = true;
+    };
+    for (const VaultFileEntry& e : entries) add(std::string(e.name, strnlen(e.name, STORE_NAME_SIZE)));
+    for (auto& h : handles) add(h.second->name); // created but not stored yet
+
+    if (!found) return -ENOENT;
+    names.assign(children.begin(), children.end());
+    return 0;
+}
+
+std::shared_ptr<VaultFs::OpenFile> VaultFs::attach(const std::string& path, bool create, uint64_t& handle) {
+    // every handle of one name shares its state, so writes through one are seen by the others
+    std::shared_ptr<OpenFile> file = openByName(path);
+    if (!file) {
+        file = std::make_shared<OpenFile>();
+        file->name = path;
+        file->nextRead = 0;
+        if (store.lookup(path, file->entry)) {
+            if (!store.layout(file->entry, file->pieces)) return nullptr;
+        } else if (create) {
+            std::memset(&file->entry, 0, sizeof(VaultFileEntry));
+        } else {
+            return nullptr;
+        }
+        reset(*file);
+    }
+    handle = nextHandle++;
+    handles[handle] = file;
+    return file;
+}
+
+void VaultFs::truncateOpen(OpenFile& file) {
+    std::lock_guard<std::mutex> fileLock(file.mutex);
+    file.blocks.clear();
+    file.size = file.storedSize = file.dirtyBytes = 0;
+    file.dirty = true; // stored on flush even if nothing is written
+}
+
+int VaultFs::open(const std::string& path, bool truncate, uint64_t& handle) {
+    std::shared_ptr<OpenFile> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        file = attach(path, false, handle);
+    }
+    if (!file) return -ENOENT;
+    if (truncate) truncateOpen(*file);
+    return 0;
+}
+
+int VaultFs::create(const std::string& path, uint64_t& handle) {
+    if (path.empty() || path.size() >= STORE_NAME_SIZE) return -ENAMETOOLONG;
+
+    // looked up and registered under one hold of the lock, a second create of the name shares this file
+    std::shared_ptr<OpenFile> file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        file = attach(path, true, handle);
+    }
+    if (!file) return -EIO;
+    truncateOpen(*file);
+    return 0;
+}
+
+int VaultFs::readPieces(OpenFile& file, uint64_t offset, uint8_t* data, size_t len) {
+    uint64_t size = file.entry.size;
+    if (offset >= size) return 0;
+    len = static_cast<size_t>(std::min<uint64_t>(len, size - offset));
+
+    // the piece holding offset, then onwards
+    size_t i = std::upper_bound(file.starts.begin(), file.starts.end(), offset) - file.starts.begin() - 1;
+    size_t done = 0;
+    while (done < len && i < file.pieces.size()) {
+        uint64_t within = offset + done - file.starts[i];
+        size_t chunk = static_cast<size_t>(std::min<uint64_t>(len - done, file.pieces[i].length - within));
+        if (!vault.read(file.pieces[i].offset + within, data + done, chunk)) return -EIO;
+        done += chunk;
+        i++;
+    }
+    return static_cast<int>(done);
+}
+
+void VaultFs::startReadahead(OpenFile& file, uint64_t from) {
+    SegmentCache* cache = vault.segmentCache();
+    uint64_t end = std::min<uint64_t>(from + FS_READAHEAD_BYTES, file.entry.size);
+    if (!cache || from >= end) return;
+
+    std::vector<Extent> ranges;
+    size_t i = std::upper_bound(file.starts.begin(), file.starts.end(), from) - file.starts.begin() - 1;
+    for (uint64_t pos = from; pos < end && i < file.pieces.size(); i++) {
+        uint64_t within = pos - file.starts[i];
+        uint64_t chunk = std::min<uint64_t>(end - pos, file.pieces[i].length - within);
+        ranges.push_back({file.pieces[i].offset + within, chunk});
+        pos += chunk;
+    }
+    file.readahead = end;
+
+    readaheadPool.submit([cache, ranges]() {
+        for (const Extent& r : ranges) cache->prefetch(r.offset, r.length);
+    });
+}
+
+int VaultFs::read(uint64_t handle, uint64_t offset, uint8_t* data, size_t len) {
+    auto file = find(handle);
+    if (!file) return -EBADF;
+    std::lock_guard<std::mutex> fileLock(file->mutex);
+    if (offset >= file->size) return 0;
+    len = static_cast<size_t>(std::min<uint64_t>(len, file->size - offset));
+
+    // a reader that carries on where it stopped gets the next window decrypted before it asks,
+    // the window is topped up once it is half used
+    if (offset == file->nextRead && offset + len + FS_READAHEAD_BYTES / 2 > file->readahead) {
+        startReadahead(*file, std::max<uint64_t>(offset + len, file->readahead));
+    }
+    if (!readCurrent(*file, offset, data, len)) return -EIO;
+    file->nextRead = offset + len;
+    return static_cast<int>(len);
+}
+
+bool VaultFs::readCurrent(OpenFile& file, uint64_t offset, uint8_t* data, size_t len) {
+    while (len > 0) {
+        uint64_t index = offset / FS_WRITE_BLOCK;
+        size_t within = static_cast<size_t>(offset % FS_WRITE_BLOCK);
+        size_t chunk = std::min<size_t>(len, FS_WRITE_BLOCK - within);
+
+        auto it = file.blocks.find(index);
+        if (it != file.blocks.end()) {
+            std::memcpy(data, it->second.data() + within, chunk);
+        } else {
+            size_t stored = (offset < file.storedSize) ? static_cast<size_t>(std::min<uint64_t>(chunk, file.storedSize - offset)) : 0;
+            if (stored > 0 && readPieces(file, offset, data, stored) != static_cast<int>(stored)) return false;
+            std::memset(data + stored, 0, chunk - stored); // past the end it was cut to, or grown into
+        }
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+int VaultFs::write(uint64_t handle, uint64_t offset, const uint8_t* data, size_t len) {
+    auto file = find(handle);
+    if (!file) return -EBADF;
+    std::lock_guard<std::mutex> fileLock(file->mutex);
+
+    size_t done = 0;
+    while (done < len) {
+        uint64_t index = (offset + done) / FS_WRITE_BLOCK;
+        size_t within = static_cast<size_t>((offset + done) % FS_WRITE_BLOCK);
+        size_t chunk = std::min<size_t>(len - done, FS_WRITE_BLOCK - within);
+
+        auto it = file->blocks.find(index);
+        if (it == file->blocks.end()) {
+            // a block only partly written keeps the rest of what the file holds there
+            std::vector<uint8_t> block(FS_WRITE_BLOCK, 0);
+            uint64_t start = index * FS_WRITE_BLOCK;
+            if ((within != 0 || chunk != FS_WRITE_BLOCK) && start < file->size &&
+                !readCurrent(*file, start, block.data(), static_cast<size_t>(std::min<uint64_t>(FS_WRITE_BLOCK, file->size - start)))) {
+                return -EIO;
+            }
+            it = file->blocks.emplace(index, std::move(block)).first;
+            file->dirtyBytes += FS_WRITE_BLOCK;
+        }
+        std::memcpy(it->second.data() + within, data + done, chunk);
+        done += chunk;
+    }
+    file->size = std::max<uint64_t>(file->size, offset + len);
+    file->dirty = true;
+
+    // a long writer is stored as it goes, so memory does not grow with the file
+    if (file->dirtyBytes >= FS_MAX_DIRTY_BYTES) {
+        int rc = commit(*file);
+        if (rc != 0) return rc;
+    }
+    return static_cast<int>(len);
+}
+
+int VaultFs::truncate(const std::string& path, uint64_t size) {
+    uint64_t handle;
+    int rc = open(path, false, handle);
+    if (rc != 0) return rc;
+    auto file = find(handle);
+    if (!file) return -EBADF;
+    {
+        std::lock_guard<std::mutex> fileLock(file->mutex);
+        // whatever lies past the new end reads as zeros if the file grows again
+        file->storedSize = std::min(file->storedSize, size);
+        file->blocks.erase(file->blocks.lower_bound((size + FS_WRITE_BLOCK - 1) / FS_WRITE_BLOCK), file->blocks.end());
+        auto last = file->blocks.find(size / FS_WRITE_BLOCK);
+        if (last != file->blocks.end()) {
+            std::fill(last->second.begin() + static_cast<size_t>(size % FS_WRITE_BLOCK), last->second.end(), 0);
+        }
+        file->dirtyBytes = file->blocks.size() * FS_WRITE_BLOCK;
+        file->size = size;
+        file->dirty = true;
+    }
+    return release(handle);
+}
+
+void VaultFs::reset(OpenFile& file) {
+    file.starts.clear();
+    uint64_t pos = 0;
+    for (const Extent& piece : file.pieces) {
+        file.starts.push_back(pos);
+        pos += piece.length;
+    }
+    file.blocks.clear();
+    file.size = file.storedSize = file.entry.size;
+    file.dirtyBytes = 0;
+    file.dirty = false;
+    file.readahead = 0;
+}
+
+int VaultFs::commit(OpenFile& file) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // a created file gets an empty entry first and is then filled in like any other
+    VaultFileEntry current;
+    if (!store.lookup(file.name, current)) {
+        std::istringstream empty;
+        if (!store.add(file.name, empty, 0)) {
+            std::cerr << "[Error] " << store.error() << "\n";
+            return -ENOSPC;
+        }
+    }
+
+    // the written blocks, and the zeros between the end it was cut to and where it ends now
+    std::vector<Extent> ranges;
+    for (const auto& block : file.blocks) {
+        uint64_t start = block.first * FS_WRITE_BLOCK;
+        if (start < file.size) ranges.push_back({start, std::min<uint64_t>(FS_WRITE_BLOCK, file.size - start)});
+    }
+    if (file.storedSize < file.size) ranges.push_back({file.storedSize, file.size - file.storedSize});
+    std::sort(ranges.begin(), ranges.end(), [](const Extent& a, const Extent& b) { return a.offset < b.offset; });
+    std::vector<Extent> dirty;
+    for (const Extent& r : ranges) {
+        if (!dirty.empty() && r.offset <= dirty.back().offset + dirty.back().length) {
+            dirty.back().length = std::max(dirty.back().length, r.offset + r.length - dirty.back().offset);
+        } else {
+            dirty.push_back(r);
+        }
+    }
+
+    StoreReader readNew = [&](uint64_t offset, uint8_t* data, size_t len) {
+        return readCurrent(file, offset, data, len);
+    };
+    if (!store.update(file.name, file.size, dirty, readNew) || !store.flush()) {
+        std::cerr << "[Error] " << store.error() << "\n";
+        return -EIO;
+    }
+    if (!store.lookup(file.name, file.entry) || !store.layout(file.entry, file.pieces)) return -EIO;
+
+    // later reads go to the vault again, the blocks are given back
+    reset(file);
+    return 0;
+}
+
+int VaultFs::flush(uint64_t handle) {
+    auto file = find(handle);
+    if (!file) return -EBADF;
+    std::lock_guard<std::mutex> fileLock(file->mutex);
+    return file->dirty ? commit(*file) : 0;
+}
+
+int VaultFs::release(uint64_t handle) {
+    int rc = flush(handle);
+    std::lock_guard<std::mutex> lock(mutex);
+    handles.erase(handle);
+    return rc;
+}
+
+int VaultFs::unlink(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!store.remove(path)) return -ENOENT;
+    if (!store.flush()) return -EIO;
+    return 0;
+}
+
+int VaultFs::rename(const std::string& from, const std::string& to) {
+    if (to.empty() || to.size() >= STORE_NAME_SIZE) return -ENAMETOOLONG;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VaultFileEntry entry;
+    if (!store.lookup(from, entry)) return -ENOENT;
+    if (store.lookup(to, entry) && !store.remove(to)) return -EIO; // replaces the target, like rename(2)
+    if (!store.rename(from, to) || !store.flush()) {
+        std::cerr << "[Error] " << store.error() << "\n";
+        return -EIO;
+    }
+    for (auto& h : handles) {
+        if (h.second->name == from) h.second->name = to;
+    }
+    return 0;
+}
+
+#ifdef SFM_FUSE
+
+static VaultFs& currentFs() {
+    return *static_cast<VaultFs*>(fuse_get_context()->private_data);
+}
+
+static std::string relative(const char* path) {
+    return (path[0] == '/') ? std::string(path + 1) : std::string(path);
+}
+
+static int fuseGetattr(const char* path, struct stat* st, struct fuse_file_info*) {
+    VaultFsStat info;
+    int rc = currentFs().getattr(relative(path), info);
+    if (rc != 0) return rc;
+
+    std::memset(st, 0, sizeof(struct stat));
+    st->st_mode = info.directory ? (S_IFDIR | 0700) : (S_IFREG | 0600);
+    st->st_nlink = info.directory ? 2 : 1;
+    st->st_size = static_cast<off_t>(info.size);
+    st->st_mtime = static_cast<time_t>(info.modified);
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    return 0;
+}
+
+static int fuseReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info*,
+                       enum fuse_readdir_flags) {
+    std::vector<std::string> names;
+    int rc = currentFs().readdir(relative(path), names);
+    if (rc != 0) return rc;
+
+    filler(buf, ".", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    filler(buf, "..", nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    for (const auto& name : names) filler(buf, name.c_str(), nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    return 0;
+}
+
+static int fuseOpen(const char* path, struct fuse_file_info* fi) {
+    uint64_t handle;
+    int rc = currentFs().open(relative(path), (fi->flags & O_TRUNC) != 0, handle);
+    if (rc == 0) fi->fh = handle;
+    return rc;
+}
+
+static int fuseCreate(const char* path, mode_t, struct fuse_file_info* fi) {
+    uint64_t handle;
+    int rc = currentFs().create(relative(path), handle);
+    if (rc == 0) fi->fh = handle;
+    return rc;
+}
+
+static int fuseRead(const char*, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    return currentFs().read(fi->fh, static_cast<uint64_t>(offset), reinterpret_cast<uint8_t*>(buf), size);
+}
+
+static int fuseWrite(const char*, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    return currentFs().write(fi->fh, static_cast<uint64_t>(offset), reinterpret_cast<const uint8_t*>(buf), size);
+}
+
+static int fuseTruncate(const char* path, off_t size, struct fuse_file_info*) {
+    return currentFs().truncate(relative(path), static_cast<uint64_t>(size));
+}
+
+static int fuseFlush(const char*, struct fuse_file_info* fi) {
+    return currentFs().flush(fi->fh);
+}
+
+static int fuseRelease(const char*, struct fuse_file_info* fi) {
+    return currentFs().release(fi->fh);
+}
+
+static int fuseUnlink(const char* path) {
+    return currentFs().unlink(relative(path));
+}
+
+static int fuseRename(const char* from, const char* to, unsigned int flags) {
+    if (flags != 0) return -EINVAL; // no RENAME_EXCHANGE / RENAME_NOREPLACE
+    return currentFs().rename(relative(from), relative(to));
+}
+
+static int fuseUtimens(const char*, const struct timespec[2], struct fuse_file_info*) {
+    return 0; // the store keeps the time of the last write, touch should not fail
+}
+
+bool runMount(VaultFs& fs, const std::string& mountPoint) {
+    struct fuse_operations ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.getattr = fuseGetattr;
+    ops.readdir = fuseReaddir;
+    ops.open = fuseOpen;
+    ops.create = fuseCreate;
+    ops.read = fuseRead;
+    ops.write = fuseWrite;
+    ops.truncate = fuseTruncate;
+    ops.flush = fuseFlush;
+    ops.release = fuseRelease;
+    ops.unlink = fuseUnlink;
+    ops.rename = fuseRename;
+    ops.utimens = fuseUtimens;
+
+    // foreground: the key and the cache live in this process. default_permissions keeps other users out
+    std::vector<std::string> args = {"sfm_tool", "-f", "-o", "default_permissions", mountPoint};
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(&arg[0]);
+    return fuse_main(static_cast<int>(argv.size()), argv.data(), &ops, &fs) == 0;
+}
+
+#else
+
+bool runMount(VaultFs&, const std::string&) {
+    std::cerr << "[Error] This build has no FUSE support, rebuild with -DSFM_FUSE and libfuse3.\n";
+    return false;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef MOUNT_H
+#define MOUNT_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "allocator.h"
+#include "store.h"
+#include "thread_pool.h"
+
+class Vault;
+
+#define FS_READAHEAD_BYTES (2 * 1024 * 1024) // decrypted ahead of a sequential reader
+#define FS_WRITE_BLOCK (64 * 1024) // writes are buffered in blocks of this size
+#define FS_MAX_DIRTY_BYTES (64ULL * 1024 * 1024) // written back before flush once a file buffers this much
+
+struct VaultFsStat {
+    bool directory;
+    uint64_t size;
+    uint64_t modified; // unix time
+};
+
+// The files of a vault's store as a filesystem tree (names containing '/' form the directories).
+// Every method returns 0 (or a byte count) on success and -errno on failure, like the FUSE
+// callbacks in mount.cpp that wrap them. Reads go through the vault's segment cache and a
+// sequential reader gets the next FS_READAHEAD_BYTES decrypted in the background. Writes are
+// coalesced per open file in the FS_WRITE_BLOCK blocks they touch and stored on flush / release
+// (or once FS_MAX_DIRTY_BYTES are buffered), where only the chunks under those blocks are written again.
+class VaultFs {
+public:
+    VaultFs(Vault& vault, VaultStore& store);
+    ~VaultFs();
+
+    int getattr(const std::string& path, VaultFsStat& st);
+    int readdir(const std::string& path, std::vector<std::string>& names);
+    int open(const std::string& path, bool truncate, uint64_t& handle);
+    int create(const std::string& path, uint64_t& handle);
+    int read(uint64_t handle, uint64_t offset, uint8_t* data, size_t len);
+    int write(uint64_t handle, uint64_t offset, const uint8_t* data, size_t len);
+    int truncate(const std::string& path, uint64_t size);
+    int flush(uint64_t handle);
+    int release(uint64_t handle);
+    int unlink(const std::string& path);
+    int rename(const std::string& from, const std::string& to);
+
+private:
+    struct OpenFile {
+        std::mutex mutex;
+        std::string name;
+        VaultFileEntry entry;
+        std::vector<Extent> pieces;   // VaultStore::layout, in file order
+        std::vector<uint64_t> starts; // file offset of each piece
+        std::map<uint64_t, std::vector<uint8_t>> blocks; // written and not stored yet, by block index
+        uint64_t size;                // what the file is now, stored or not
+        uint64_t storedSize;          // below this, bytes no block covers come from pieces, above it they are zeros
+        uint64_t dirtyBytes;
+        bool dirty;
+        uint64_t nextRead;            // where a sequential reader continues
+        uint64_t readahead;           // prefetched up to here
+    };
+
+    Vault& vault;
+    VaultStore& store;
+    std::mutex mutex; // handles, and every call into the store
+    std::map<uint64_t, std::shared_ptr<OpenFile>> handles;
+    uint64_t nextHandle;
+    WorkStealingPool readaheadPool;
+
+    std::shared_ptr<OpenFile> find(uint64_t handle);
+    std::shared_ptr<OpenFile> openByName(const std::string& name); // an open handle of that file, if any
+    // under mutex: a new handle on the open file, else on the stored one, else (create) on a new empty one
+    std::shared_ptr<OpenFile> attach(const std::string& path, bool create, uint64_t& handle);
+    void truncateOpen(OpenFile& file); // size 0, stored as such on the next commit
+    void reset(OpenFile& file); // nothing buffered, the file is what the store holds
+    int commit(OpenFile& file); // stores the buffered blocks under the file's name
+    int readPieces(OpenFile& file, uint64_t offset, uint8_t* data, size_t len);
+    bool readCurrent(OpenFile& file, uint64_t offset, uint8_t* data, size_t len); // blocks over pieces, within size
+    void startReadahead(OpenFile& file, uint64_t from);
+};
+
+// runs in the foreground until the directory is unmounted (fusermount3 -u, or Ctrl-C).
+// false straight away in builds without SFM_FUSE
+bool runMount(VaultFs& fs, const std::string& mountPoint);
+
+#endif
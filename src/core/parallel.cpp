@@ -0,0 +1,219 @@
+#include "parallel.h"
+#include "stats.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#define PIPELINE_DEPTH 4 // chunks in flight between the three single-thread stages
+#define RING_SPINS 64    // yields before a waiting stage starts sleeping
+
+// Single producer / single consumer ring of slot indices, capacity a power of two.
+// Each side only writes its own counter, the other one only reads it.
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : items(capacity), mask(capacity - 1), head(0), tail(0) { }
+
+    bool push(size_t value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == items.size()) return false;
+        items[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(size_t& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = items[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<size_t> items;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+// a stage that waits is out of work for a whole chunk (~1 MB of I/O or crypto), so after a short
+// spin it sleeps instead of burning the core the other stages need
+static bool waitPop(SpscRing& ring, size_t& value, const std::atomic<bool>& failed) {
+    for (int spins = 0; !ring.pop(value); spins++) {
+        if (failed.load(std::memory_order_relaxed)) return false;
+        if (spins < RING_SPINS) std::this_thread::yield();
+        else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+    return true;
+}
+
+// read -> transform -> write on one thread each, chunks handed along through the rings and
+// their buffers reused, so a single stream runs at the speed of its slowest stage
+static bool runThreeStages(uint64_t chunkCount, const std::function<void(SegmentChunk&, uint64_t)>& setup,
+                           const ChunkStage& read, const ChunkWorker& transform, const ChunkStage& write) {
+    std::vector<SegmentChunk> slots(PIPELINE_DEPTH);
+    SpscRing freeSlots(PIPELINE_DEPTH), readSlots(PIPELINE_DEPTH), doneSlots(PIPELINE_DEPTH);
+    for (size_t i = 0; i < PIPELINE_DEPTH; i++) freeSlots.push(i);
+    std::atomic<bool> failed(false);
+
+    std::thread reader([&]() {
+        size_t slot;
+        for (uint64_t n = 0; n < chunkCount && waitPop(freeSlots, slot, failed); n++) {
+            setup(slots[slot], n);
+            if (!read(slots[slot])) {
+                failed = true;
+                return;
+            }
+            readSlots.push(slot); // never full, only PIPELINE_DEPTH slots exist
+        }
+    });
+
+    std::thread crypto([&]() {
+        size_t slot;
+        for (uint64_t n = 0; n < chunkCount && waitPop(readSlots, slot, failed); n++) {
+            if (!transform(slots[slot], 0)) {
+                failed = true;
+                return;
+            }
+            doneSlots.push(slot);
+        }
+    });
+
+    size_t slot;
+    for (uint64_t n = 0; n < chunkCount && waitPop(doneSlots, slot, failed); n++) {
+        if (!write(slots[slot])) {
+            failed = true;
+            break;
+        }
+        freeSlots.push(slot);
+    }
+
+    reader.join();
+    crypto.join();
+    return !failed;
+}
+
+int defaultThreadCount() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n == 0) ? 1 : static_cast<int>(n);
+}
+
+bool runSegmentPipeline(uint64_t first, uint64_t last, int threads,
+                        const ChunkStage& readStage, const ChunkWorker& transformStage, const ChunkStage& writeStage) {
+    // every stage is timed per chunk, that is what tells an I/O-bound run from a CPU-bound one
+    ChunkStage read = [&](SegmentChunk& chunk) {
+        StatTimer timer(STAT_READ_NS, "read chunk");
+        return readStage(chunk);
+    };
+    ChunkWorker transform = [&](SegmentChunk& chunk, int worker) {
+        StatTimer timer(STAT_CRYPTO_NS, "crypto chunk");
+        bool ok = transformStage(chunk, worker);
+        statAdd(STAT_CRYPTO_BYTES, chunk.out.size());
+        return ok;
+    };
+    ChunkStage write = [&](SegmentChunk& chunk) {
+        StatTimer timer(STAT_WRITE_NS, "write chunk");
+        return writeStage(chunk);
+    };
+
+    uint64_t chunkCount = (last - first) / SEGMENTS_PER_CHUNK + 1;
+    if (threads < 1) threads = 1;
+    if (static_cast<uint64_t>(threads) > chunkCount) threads = static_cast<int>(chunkCount);
+
+    auto setup = [&](SegmentChunk& chunk, uint64_t n) {
+        chunk.first = first + n * SEGMENTS_PER_CHUNK;
+        uint64_t left = last + 1 - chunk.first;
+        chunk.count = (left < SEGMENTS_PER_CHUNK) ? left : SEGMENTS_PER_CHUNK;
+    };
+
+    if (chunkCount == 1) {
+        SegmentChunk chunk;
+        setup(chunk, 0);
+        return read(chunk) && transform(chunk, 0) && write(chunk);
+    }
+    if (threads == 1) return runThreeStages(chunkCount, setup, read, transform, write);
+
+    // chunk n always lives in slot n % slotCount, the writer frees slots in order
+    enum SlotState { FREE, QUEUED, DONE };
+    const size_t slotCount = threads * 2;
+    std::vector<SegmentChunk> slots(slotCount);
+    std::vector<SlotState> state(slotCount, FREE);
+    std::deque<size_t> queued;
+    bool failed = false;
+    bool readDone = false;
+    std::mutex m;
+    std::condition_variable cv;
+
+    std::thread reader([&]() {
+        for (uint64_t n = 0; n < chunkCount; n++) {
+            size_t slot = n % slotCount;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [&]() { return state[slot] == FREE || failed; });
+                if (failed) break;
+            }
+            setup(slots[slot], n);
+            bool ok = read(slots[slot]);
+
+            std::lock_guard<std::mutex> lock(m);
+            if (!ok) {
+                failed = true;
+                break;
+            }
+            state[slot] = QUEUED;
+            queued.push_back(slot);
+            cv.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(m);
+        readDone = true;
+        cv.notify_all();
+    });
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; w++) {
+        workers.emplace_back([&, w]() {
+            while (true) {
+                size_t slot;
+                {
+                    std::unique_lock<std::mutex> lock(m);
+                    cv.wait(lock, [&]() { return !queued.empty() || failed || readDone; });
+                    if (failed || queued.empty()) return;
+                    slot = queued.front();
+                    queued.pop_front();
+                }
+                bool ok = transform(slots[slot], w);
+
+                std::lock_guard<std::mutex> lock(m);
+                if (ok) state[slot] = DONE;
+                else failed = true;
+                cv.notify_all();
+            }
+        });
+    }
+
+    for (uint64_t n = 0; n < chunkCount; n++) {
+        size_t slot = n % slotCount;
+        {
+            std::unique_lock<std::mutex> lock(m);
+            cv.wait(lock, [&]() { return state[slot] == DONE || failed; });
+            if (failed) break;
+        }
+        bool ok = write(slots[slot]);
+
+        std::lock_guard<std::mutex> lock(m);
+        if (!ok) {
+            failed = true;
+            cv.notify_all();
+            break;
+        }
+        state[slot] = FREE;
+        cv.notify_all();
+    }
+
+    reader.join();
+    for (auto& t : workers) t.join();
+    return !failed;
+}
@@ -0,0 +1,32 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+#define SEGMENTS_PER_CHUNK 16 // 1 MB of plaintext per work item
+
+// a run of consecutive segments travelling through the pipeline
+struct SegmentChunk {
+    uint64_t first;
+    uint64_t count;
+    const uint8_t* src = nullptr; // input bytes: into `in`, or straight into a mapped file
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+};
+
+typedef std::function<bool(SegmentChunk& chunk)> ChunkStage;
+typedef std::function<bool(SegmentChunk& chunk, int worker)> ChunkWorker;
+
+int defaultThreadCount();
+
+// Runs read -> transform -> write over segments [first, last].
+// read runs on its own thread and write on the calling one, both in segment order.
+// transform runs on up to `threads` workers, at most 2 chunks per worker are in flight.
+// With one worker the three stages hand chunks along through lock-free rings instead.
+// Stops at the first stage that returns false.
+bool runSegmentPipeline(uint64_t first, uint64_t last, int threads,
+                        const ChunkStage& read, const ChunkWorker& transform, const ChunkStage& write);
+
+#endif
@@ -0,0 +1,86 @@
+#include "progress.h"
+#include <chrono>
+#include <iostream>
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+double JobProgress::Snapshot::etaSeconds() const {
+    double rate = bytesPerSecond();
+    if (rate <= 0 || done == 0) return -1;
+    return (total > done) ? (total - done) / rate : 0;
+}
+
+JobProgress::JobProgress() : stage(""), done(0), total(0), startNs(nowNs()), stopRequested(false) { }
+
+void JobProgress::reset() {
+    stopRequested = false;
+    begin("", 0);
+}
+
+void JobProgress::begin(const char* name, uint64_t bytes) {
+    // the stage is published last, a reader that sees it also sees the fresh counters
+    done = 0;
+    total = bytes;
+    startNs = nowNs();
+    stage = name;
+}
+
+void JobProgress::advance(uint64_t bytes) {
+    done.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void JobProgress::cancel() {
+    stopRequested = true;
+}
+
+bool JobProgress::cancelled() const {
+    return stopRequested.load(std::memory_order_relaxed);
+}
+
+JobProgress::Snapshot JobProgress::snapshot() const {
+    Snapshot s;
+    s.stage = stage;
+    s.done = done.load(std::memory_order_relaxed);
+    s.total = total.load(std::memory_order_relaxed);
+    s.seconds = (nowNs() - startNs.load()) / 1e9;
+    if (s.done > s.total) s.done = s.total;
+    return s;
+}
+
+BackgroundJob::BackgroundJob() : done(true), result(false), oldOut(nullptr), oldErr(nullptr) { }
+
+BackgroundJob::~BackgroundJob() {
+    wait();
+}
+
+void BackgroundJob::start(const std::function<bool()>& job) {
+    wait();
+    captured.text.clear();
+    oldOut = std::cout.rdbuf(&captured);
+    oldErr = std::cerr.rdbuf(&captured);
+    done = false;
+    worker = std::thread([this, job]() {
+        bool ok = false;
+        try {
+            ok = job();
+        } catch (const std::exception& e) {
+            std::cerr << "[Error] " << e.what() << "\n";
+        }
+        result = ok;
+        done = true;
+    });
+}
+
+bool BackgroundJob::finished() const {
+    return done;
+}
+
+bool BackgroundJob::wait() {
+    if (!worker.joinable()) return result;
+    worker.join();
+    std::cout.rdbuf(oldOut);
+    std::cerr.rdbuf(oldErr);
+    return result;
+}
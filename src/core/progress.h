@@ -0,0 +1,89 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+// Progress of one long operation (encrypt, decrypt, wipe, vault prefill). The thread doing the
+// work calls begin / advance and gives up at the next chunk once cancelled() is set, any other
+// thread may read snapshot() or call cancel() meanwhile.
+class JobProgress {
+public:
+    struct Snapshot {
+        const char* stage;
+        uint64_t done;
+        uint64_t total;
+        double seconds; // since the stage began
+
+        double fraction() const { return (total > 0) ? static_cast<double>(done) / total : 0; }
+        double bytesPerSecond() const { return (seconds > 0) ? done / seconds : 0; }
+        double etaSeconds() const; // -1 while nothing has moved yet
+    };
+
+    JobProgress();
+
+    void reset(); // before a new job, also clears a cancel
+    void begin(const char* stage, uint64_t total); // stage must outlive the job, e.g. a literal
+    void advance(uint64_t bytes);
+    void cancel();
+    bool cancelled() const;
+    Snapshot snapshot() const;
+
+private:
+    std::atomic<const char*> stage;
+    std::atomic<uint64_t> done;
+    std::atomic<uint64_t> total;
+    std::atomic<int64_t> startNs; // steady clock
+    std::atomic<bool> stopRequested;
+};
+
+// std::cout / std::cerr redirected into a string, worker threads may print at the same time
+class LockedStringBuf : public std::streambuf {
+public:
+    std::string text;
+
+protected:
+    int overflow(int c) override {
+        if (c == EOF) return 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        text.push_back(static_cast<char>(c));
+        return c;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        text.append(s, static_cast<size_t>(n));
+        return n;
+    }
+
+private:
+    std::mutex mutex;
+};
+
+// Runs one job on its own thread while the caller keeps polling finished(), e.g. to redraw a
+// progress bar. Whatever the job prints is captured until wait(): a curses screen must not be
+// written to from two threads.
+class BackgroundJob {
+public:
+    BackgroundJob();
+    ~BackgroundJob(); // waits for a job that is still running
+
+    void start(const std::function<bool()>& job);
+    bool finished() const;
+    bool wait(); // the job's result, std::cout / std::cerr are restored
+    std::string output() const { return captured.text; } // only once wait() returned
+
+private:
+    std::thread worker;
+    std::atomic<bool> done;
+    bool result;
+    LockedStringBuf captured;
+    std::streambuf* oldOut;
+    std::streambuf* oldErr;
+};
+
+#endif
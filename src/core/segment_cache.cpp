@@ -0,0 +1,116 @@
+#include "segment_cache.h"
+#include "vault.h"
+#include <algorithm>
+#include <cstring>
+
+#include <cryptopp/misc.h>
+
+SegmentCache::SegmentCache(Vault& v, uint64_t capacityBytes)
+    : vault(v), segmentSize(v.segmentSize()), hitCount(0), missCount(0) {
+    uint64_t segments = capacityBytes / segmentSize;
+    perShard = static_cast<size_t>(std::max<uint64_t>(1, segments / SEGMENT_CACHE_SHARDS));
+}
+
+SegmentCache::~SegmentCache() {
+    for (Shard& shard : shards) {
+        for (Entry& entry : shard.lru) CryptoPP::SecureWipeBuffer(entry.plain.data(), entry.plain.size());
+    }
+}
+
+SegmentCache::Entry* SegmentCache::acquire(Shard& shard, uint64_t index, bool load) {
+    auto it = shard.entries.find(index);
+    if (it != shard.entries.end()) {
+        hitCount.fetch_add(1, std::memory_order_relaxed);
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return &shard.lru.front();
+    }
+    missCount.fetch_add(1, std::memory_order_relaxed);
+
+    // the least recently used segment makes room, written back first if it was changed
+    std::vector<uint8_t> plain;
+    if (shard.lru.size() >= perShard) {
+        Entry& victim = shard.lru.back();
+        if (victim.dirty && !vault.writeSegment(victim.index, victim.plain.data())) return nullptr;
+        // the buffer is reused, but a failed load or a caller that only overwrites it must not find the old plaintext
+        CryptoPP::SecureWipeBuffer(victim.plain.data(), victim.plain.size());
+        plain.swap(victim.plain);
+        shard.entries.erase(victim.index);
+        shard.lru.pop_back();
+    }
+
+    plain.resize(segmentSize);
+    if (load) {
+        if (!vault.readSegment(index, plain.data())) {
+            CryptoPP::SecureWipeBuffer(plain.data(), plain.size()); // may hold what failed to verify
+            return nullptr;
+        }
+    }
+
+    shard.lru.push_front({index, std::move(plain), false});
+    shard.entries[index] = shard.lru.begin();
+    return &shard.lru.front();
+}
+
+bool SegmentCache::read(uint64_t offset, uint8_t* data, size_t len) {
+    while (len > 0) {
+        uint64_t index = offset / segmentSize;
+        size_t within = static_cast<size_t>(offset % segmentSize);
+        size_t chunk = std::min<size_t>(len, segmentSize - within);
+
+        Shard& shard = shards[index % SEGMENT_CACHE_SHARDS];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            Entry* entry = acquire(shard, index, true);
+            if (!entry) return false;
+            std::memcpy(data, entry->plain.data() + within, chunk);
+        }
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+bool SegmentCache::write(uint64_t offset, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        uint64_t index = offset / segmentSize;
+        size_t within = static_cast<size_t>(offset % segmentSize);
+        size_t chunk = std::min<size_t>(len, segmentSize - within);
+
+        Shard& shard = shards[index % SEGMENT_CACHE_SHARDS];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            Entry* entry = acquire(shard, index, chunk != segmentSize);
+            if (!entry) return false;
+            std::memcpy(entry->plain.data() + within, data, chunk);
+            entry->dirty = true;
+        }
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+void SegmentCache::prefetch(uint64_t offset, uint64_t len) {
+    if (len == 0) return;
+    uint64_t last = (offset + len - 1) / segmentSize;
+    for (uint64_t index = offset / segmentSize; index <= last && index < vault.segmentCount(); index++) {
+        Shard& shard = shards[index % SEGMENT_CACHE_SHARDS];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!acquire(shard, index, true)) return;
+    }
+}
+
+bool SegmentCache::flush() {
+    bool ok = true;
+    for (Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (Entry& entry : shard.lru) {
+            if (!entry.dirty) continue;
+            if (vault.writeSegment(entry.index, entry.plain.data())) entry.dirty = false;
+            else ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef SEGMENT_CACHE_H
+#define SEGMENT_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Vault;
+
+#define SEGMENT_CACHE_SHARDS 16
+#define SEGMENT_CACHE_DEFAULT_BYTES (64 * 1024 * 1024)
+
+// Decrypted vault segments behind Vault::read / Vault::write. Each shard (segment index % shards)
+// is its own LRU with its own lock, so readers of different segments rarely wait on each other.
+// Writes only patch the cached plaintext and mark it dirty; the segment is encrypted and written
+// back when it is evicted or on flush, so many small writes to one segment cost one encryption.
+// Plaintext is wiped when a segment is evicted and when the cache goes away.
+class SegmentCache {
+public:
+    SegmentCache(Vault& vault, uint64_t capacityBytes);
+    ~SegmentCache();
+
+    bool read(uint64_t offset, uint8_t* data, size_t len);
+    bool write(uint64_t offset, const uint8_t* data, size_t len);
+    bool flush(); // writes back every dirty segment, they stay cached
+    void prefetch(uint64_t offset, uint64_t len); // decrypts the segments into the cache, no copy
+
+    uint64_t hits() const { return hitCount.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return missCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Entry {
+        uint64_t index;
+        std::vector<uint8_t> plain;
+        bool dirty;
+    };
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru; // most recently used first
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+    };
+
+    Vault& vault;
+    size_t segmentSize;
+    size_t perShard; // segments each shard may hold
+    Shard shards[SEGMENT_CACHE_SHARDS];
+    std::atomic<uint64_t> hitCount; // bumped under different shard locks
+    std::atomic<uint64_t> missCount;
+
+    // the cached segment, loaded (decrypted) unless the caller overwrites all of it. nullptr on error
+    Entry* acquire(Shard& shard, uint64_t index, bool load);
+};
+
+#endif
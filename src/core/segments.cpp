@@ -0,0 +1,119 @@
+#include "segments.h"
+#include "functions.h"
+#include "compress.h"
+#include <istream>
+#include <ostream>
+#include <cstring>
+
+#include <cryptopp/gcm.h>
+
+using namespace CryptoPP;
+
+SegmentHeader createSegmentHeader(uint64_t plainSize) {
+    SegmentHeader seg;
+    std::memset(&seg, 0, sizeof(SegmentHeader));
+    seg.headerSize = sizeof(SegmentHeader);
+    seg.segmentSize = SEGMENT_SIZE;
+    seg.plainSize = plainSize;
+    // an empty file still gets one (empty) segment so there is always a tag to check
+    seg.segmentCount = (plainSize == 0) ? 1 : (plainSize + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+    return seg;
+}
+
+uint64_t segmentPlainLength(const SegmentHeader& seg, uint64_t index) {
+    uint64_t start = index * seg.segmentSize;
+    if (start >= seg.plainSize) return 0;
+    uint64_t left = seg.plainSize - start;
+    return (left < seg.segmentSize) ? left : seg.segmentSize;
+}
+
+std::vector<SegmentEntry> buildSegmentTable(const SegmentHeader& seg, uint64_t dataOffset) {
+    std::vector<SegmentEntry> table(seg.segmentCount);
+    uint64_t offset = dataOffset;
+    for (uint64_t i = 0; i < seg.segmentCount; i++) {
+        table[i].offset = offset;
+        table[i].length = static_cast<uint32_t>(segmentPlainLength(seg, i) + AUTH_TAG_SIZE);
+        table[i].flags = 0;
+        offset += table[i].length;
+    }
+    return table;
+}
+
+bool readSegmentHeader(std::istream& in, SegmentHeader& seg) {
+    std::memset(&seg, 0, sizeof(SegmentHeader));
+
+    uint32_t headerSize = 0;
+    if (!in.read(reinterpret_cast<char*>(&headerSize), sizeof(headerSize))) return false;
+    if (headerSize < sizeof(headerSize) || headerSize > 4096) return false;
+
+    // older writers may have a shorter header (missing fields stay zero), newer ones a longer one
+    size_t known = (headerSize < sizeof(SegmentHeader)) ? headerSize : sizeof(SegmentHeader);
+    if (!in.read(reinterpret_cast<char*>(&seg) + sizeof(headerSize), known - sizeof(headerSize))) return false;
+    if (headerSize > known) in.seekg(headerSize - known, std::ios::cur);
+    seg.headerSize = headerSize;
+
+    if (seg.segmentSize == 0 || seg.segmentCount == 0) return false;
+    if (seg.keyMode != KEY_MODE_SCRYPT && seg.keyMode != KEY_MODE_HKDF && seg.keyMode != KEY_MODE_WRAPPED) return false;
+    if (!isSupportedCodec(seg.codec)) return false;
+    if (seg.segmentCount != ((seg.plainSize == 0) ? 1 : (seg.plainSize + seg.segmentSize - 1) / seg.segmentSize)) return false;
+    return static_cast<bool>(in);
+}
+
+bool readSegmentTable(std::istream& in, const SegmentHeader& seg, std::vector<SegmentEntry>& table) {
+    table.resize(seg.segmentCount);
+    in.read(reinterpret_cast<char*>(table.data()), seg.segmentCount * sizeof(SegmentEntry));
+    return static_cast<bool>(in);
+}
+
+void writeSegmentHeader(std::ostream& out, const SegmentHeader& seg, const std::vector<SegmentEntry>& table) {
+    out.write(reinterpret_cast<const char*>(&seg), sizeof(SegmentHeader));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(SegmentEntry));
+}
+
+void deriveSegmentNonce(const uint8_t* baseNonce, uint64_t index, uint8_t* out) {
+    std::memcpy(out, baseNonce, NONCE_SIZE);
+    // big endian index xored into the last 8 bytes of the file nonce
+    for (int i = 0; i < 8; i++) {
+        out[NONCE_SIZE - 1 - i] ^= static_cast<uint8_t>(index >> (8 * i));
+    }
+}
+
+void buildSegmentAAD(const SegmentHeader& seg, uint64_t index, uint8_t* out) {
+    // binds the segment to its position and to the size of the whole file (no reorder / truncation)
+    std::memcpy(out, &index, 8);
+    std::memcpy(out + 8, &seg.segmentCount, 8);
+    std::memcpy(out + 16, &seg.plainSize, 8);
+    std::memcpy(out + 24, &seg.segmentSize, 4);
+}
+
+size_t buildSegmentAAD(const SegmentHeader& seg, uint64_t index, uint32_t flags, uint8_t* out) {
+    buildSegmentAAD(seg, index, out);
+    if (flags == 0) return SEGMENT_AAD_SIZE;
+    // flipping the compressed flag in the (unauthenticated) table must break the tag
+    std::memcpy(out + SEGMENT_AAD_SIZE, &flags, 4);
+    return SEGMENT_AAD_MAX;
+}
+
+void sealSegment(AuthenticatedSymmetricCipher& encryptor, const uint8_t* baseNonce,
+                 const SegmentHeader& seg, uint64_t index, const uint8_t* plain, size_t len, uint8_t* out,
+                 uint32_t flags) {
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t aad[SEGMENT_AAD_MAX];
+    deriveSegmentNonce(baseNonce, index, nonce);
+    size_t aadLen = buildSegmentAAD(seg, index, flags, aad);
+
+    encryptor.EncryptAndAuthenticate(out, out + len, AUTH_TAG_SIZE,
+        nonce, NONCE_SIZE, aad, aadLen, plain, len);
+}
+
+bool openSegment(AuthenticatedSymmetricCipher& decryptor, const uint8_t* baseNonce,
+                 const SegmentHeader& seg, uint64_t index, const uint8_t* in, size_t len, uint8_t* plain,
+                 uint32_t flags) {
+    uint8_t nonce[NONCE_SIZE];
+    uint8_t aad[SEGMENT_AAD_MAX];
+    deriveSegmentNonce(baseNonce, index, nonce);
+    size_t aadLen = buildSegmentAAD(seg, index, flags, aad);
+
+    return decryptor.DecryptAndVerify(plain, in + len, AUTH_TAG_SIZE,
+        nonce, NONCE_SIZE, aad, aadLen, in, len);
+}
@@ -0,0 +1,83 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+namespace CryptoPP { class AuthenticatedSymmetricCipher; }
+
+#define SEGMENT_SIZE (64 * 1024)
+#define AUTH_TAG_SIZE 16
+#define SEGMENT_AAD_SIZE 28
+#define SEGMENT_AAD_MAX (SEGMENT_AAD_SIZE + 4) // flagged segments also bind their flags
+#define FILE_SALT_SIZE 16
+
+#define KEY_MODE_SCRYPT 0 // file key is scrypt(password, kdfSalt) itself
+#define KEY_MODE_HKDF 1   // file key is HKDF(scrypt master key, fileSalt), see session.h
+#define KEY_MODE_WRAPPED 2 // file key is random and stored in the key slots, wrapped per password
+
+#define KEY_SLOT_COUNT 4
+#define KEY_SLOT_USED 1
+#define WRAPPED_KEY_SIZE (32 + AUTH_TAG_SIZE)
+
+// one password's copy of the file key: AEAD(HKDF(scrypt(password, kdfSalt)), nonce, key), fileSalt as AAD.
+// a password change only rewrites the slots, the data stays as it is
+struct KeySlot {
+    uint32_t flags; // KEY_SLOT_USED
+    uint32_t kdfCost;
+    uint32_t kdfBlockSize;
+    uint32_t kdfParallelism;
+    uint8_t kdfSalt[16];
+    uint8_t nonce[12];
+    uint8_t wrappedKey[WRAPPED_KEY_SIZE];
+    uint32_t reserved;
+};
+
+// version 2 file layout:
+// SFMHeader | SegmentHeader | SegmentEntry[segmentCount] | segment 0 | segment 1 | ...
+// every segment is ciphertext followed by its own tag, the nonce is derived from the segment index.
+// with a codec the entries are no longer a fixed stride, compressed segments are shorter
+struct SegmentHeader {
+    uint32_t headerSize; // sizeof(SegmentHeader) when written, newer fields get appended
+    uint32_t segmentSize;
+    uint64_t plainSize;
+    uint64_t segmentCount;
+    uint32_t keyMode;
+    uint32_t codec; // CODEC_* from compress.h, 0 (older writers) means none
+    uint8_t fileSalt[FILE_SALT_SIZE];
+    uint32_t kdfParallelism; // scrypt p for the master key, 0 (older writers) means 1
+    uint32_t reserved2;
+    KeySlot keySlots[KEY_SLOT_COUNT]; // KEY_MODE_WRAPPED only
+};
+
+struct SegmentEntry {
+    uint64_t offset; // absolute position in the file
+    uint32_t length; // stored bytes, tag included
+    uint32_t flags;  // SEGMENT_FLAG_*
+};
+
+SegmentHeader createSegmentHeader(uint64_t plainSize);
+std::vector<SegmentEntry> buildSegmentTable(const SegmentHeader& seg, uint64_t dataOffset);
+uint64_t segmentPlainLength(const SegmentHeader& seg, uint64_t index);
+
+bool readSegmentHeader(std::istream& in, SegmentHeader& seg);
+bool readSegmentTable(std::istream& in, const SegmentHeader& seg, std::vector<SegmentEntry>& table);
+void writeSegmentHeader(std::ostream& out, const SegmentHeader& seg, const std::vector<SegmentEntry>& table);
+
+void deriveSegmentNonce(const uint8_t* baseNonce, uint64_t index, uint8_t* out);
+void buildSegmentAAD(const SegmentHeader& seg, uint64_t index, uint8_t* out);
+// SEGMENT_AAD_SIZE bytes for flags 0 (the original layout), the flags appended otherwise
+size_t buildSegmentAAD(const SegmentHeader& seg, uint64_t index, uint32_t flags, uint8_t* out);
+
+// out must hold len + AUTH_TAG_SIZE bytes
+void sealSegment(CryptoPP::AuthenticatedSymmetricCipher& encryptor, const uint8_t* baseNonce,
+                 const SegmentHeader& seg, uint64_t index, const uint8_t* plain, size_t len, uint8_t* out,
+                 uint32_t flags = 0);
+// in holds len + AUTH_TAG_SIZE bytes, false when the tag does not match
+bool openSegment(CryptoPP::AuthenticatedSymmetricCipher& decryptor, const uint8_t* baseNonce,
+                 const SegmentHeader& seg, uint64_t index, const uint8_t* in, size_t len, uint8_t* plain,
+                 uint32_t flags = 0);
+
+#endif
@@ -0,0 +1,211 @@
+#include "session.h"
+#include "segments.h"
+#include "kdf.h"
+#include "cipher.h"
+#include "stats.h"
+#include <cstring>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/hkdf.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/misc.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+using namespace CryptoPP;
+
+static const char FILE_KEY_INFO[] = "sfm file key v2";
+static const char SLOT_KEY_INFO[] = "sfm key slot v1";
+
+// keeps a cached secret out of swap. Best effort, a low RLIMIT_MEMLOCK just leaves it unlocked.
+// never unlocked again: the page may hold other keys, and the bytes are wiped by SecByteBlock anyway
+static void lockMemory(const SecByteBlock& block) {
+#ifndef _WIN32
+    if (block.size() > 0) ::mlock(block.data(), block.size());
+#endif
+}
+
+KeySession::KeySession() : unlocked(false), parallelism(1) {
+    KdfProfile builtin = builtinKdfProfile();
+    kdfCost = builtin.cost;
+    kdfBlockSize = builtin.blockSize;
+    std::memset(sessionSalt, 0, SALT_SIZE);
+}
+
+KeySession::~KeySession() {
+    clear();
+}
+
+void KeySession::setPassword(const std::string& newPassword) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (unlocked && password.size() == newPassword.size() &&
+        VerifyBufsEqual(password, reinterpret_cast<const byte*>(newPassword.data()), newPassword.size())) {
+        return;
+    }
+
+    masterKeys.clear();
+    password.Assign(reinterpret_cast<const byte*>(newPassword.data()), newPassword.size());
+    lockMemory(password);
+    AutoSeededRandomPool prng;
+    prng.GenerateBlock(sessionSalt, SALT_SIZE);
+    unlocked = true;
+}
+
+void KeySession::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    masterKeys.clear(); // SecByteBlock wipes itself
+    password.CleanNew(0);
+    std::memset(sessionSalt, 0, SALT_SIZE);
+    unlocked = false;
+}
+
+bool KeySession::hasPassword() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return unlocked;
+}
+
+static std::string cacheId(const uint8_t* salt, uint32_t cost, uint32_t blockSize, uint32_t lanes) {
+    std::string id(reinterpret_cast<const char*>(salt), SALT_SIZE);
+    id.append(reinterpret_cast<const char*>(&blockSize), sizeof(blockSize));
+    id.append(reinterpret_cast<const char*>(&cost), sizeof(cost));
+    id.append(reinterpret_cast<const char*>(&lanes), sizeof(lanes));
+    return id;
+}
+
+SecByteBlock KeySession::masterKey(const SFMHeader& header, uint32_t lanes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return deriveLocked(header.kdfSalt, header.kdfMemoryCost, header.kdfIterations, lanes == 0 ? 1 : lanes);
+}
+
+bool KeySession::isCached(const SFMHeader& header, uint32_t lanes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return masterKeys.count(cacheId(header.kdfSalt, header.kdfMemoryCost, header.kdfIterations, lanes == 0 ? 1 : lanes)) > 0;
+}
+
+SecByteBlock KeySession::deriveLocked(const uint8_t* salt, uint32_t cost, uint32_t blockSize, uint32_t lanes) {
+    std::string id = cacheId(salt, cost, blockSize, lanes);
+
+    auto it = masterKeys.find(id);
+    if (it != masterKeys.end()) return it->second;
+
+    // the lanes run on their own threads, p = 1 is a plain Crypto++ Scrypt
+    SecByteBlock key(KEY_SIZE);
+    StatTimer timer(STAT_KDF_NS, "scrypt");
+    statAdd(STAT_KDF_CALLS, 1);
+    deriveScrypt(key, key.size(),
+        password, password.size(),
+        salt, SALT_SIZE,
+        cost,
+        blockSize,
+        lanes);
+
+    masterKeys[id] = key;
+    lockMemory(masterKeys[id]);
+    return key;
+}
+
+SecByteBlock KeySession::fileKey(const SFMHeader& header, const SegmentHeader& seg) {
+    if (seg.keyMode == KEY_MODE_WRAPPED) {
+        SecByteBlock key;
+        unwrapKey(header, seg, key);
+        return key;
+    }
+
+    SecByteBlock master = masterKey(header, seg.kdfParallelism);
+    if (seg.keyMode == KEY_MODE_SCRYPT) return master;
+
+    SecByteBlock key(KEY_SIZE);
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(key, key.size(),
+        master, master.size(),
+        seg.fileSalt, FILE_SALT_SIZE,
+        reinterpret_cast<const byte*>(FILE_KEY_INFO), sizeof(FILE_KEY_INFO) - 1);
+    return key;
+}
+
+SecByteBlock KeySession::slotKey(const KeySlot& slot) {
+    SecByteBlock master;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        master = deriveLocked(slot.kdfSalt, slot.kdfCost, slot.kdfBlockSize, slot.kdfParallelism == 0 ? 1 : slot.kdfParallelism);
+    }
+
+    SecByteBlock key(KEY_SIZE);
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(key, key.size(),
+        master, master.size(),
+        nullptr, 0,
+        reinterpret_cast<const byte*>(SLOT_KEY_INFO), sizeof(SLOT_KEY_INFO) - 1);
+    return key;
+}
+
+SecByteBlock KeySession::newDataKey(const SFMHeader& header, SegmentHeader& seg) {
+    SecByteBlock dataKey(KEY_SIZE);
+    AutoSeededRandomPool prng;
+    prng.GenerateBlock(dataKey, dataKey.size());
+    wrapKey(header, seg, 0, dataKey);
+    return dataKey;
+}
+
+void KeySession::wrapKey(const SFMHeader& header, SegmentHeader& seg, int slot, const SecByteBlock& dataKey) {
+    KeySlot& target = seg.keySlots[slot];
+    std::memset(&target, 0, sizeof(KeySlot));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::memcpy(target.kdfSalt, sessionSalt, SALT_SIZE);
+        target.kdfCost = kdfCost;
+        target.kdfBlockSize = kdfBlockSize;
+        target.kdfParallelism = parallelism;
+    }
+    AutoSeededRandomPool prng;
+    prng.GenerateBlock(target.nonce, NONCE_SIZE);
+
+    // the file salt as AAD ties the slot to its file
+    SecByteBlock kek = slotKey(target);
+    auto cipher = makeCipher(header.algoType, true, kek, target.nonce);
+    cipher->EncryptAndAuthenticate(target.wrappedKey, target.wrappedKey + KEY_SIZE, AUTH_TAG_SIZE,
+        target.nonce, NONCE_SIZE, seg.fileSalt, FILE_SALT_SIZE, dataKey, KEY_SIZE);
+    target.flags = KEY_SLOT_USED;
+}
+
+int KeySession::unwrapKey(const SFMHeader& header, const SegmentHeader& seg, SecByteBlock& dataKey) {
+    if (!isSupportedAlgo(header.algoType)) return -1;
+    for (int i = 0; i < KEY_SLOT_COUNT; i++) {
+        const KeySlot& slot = seg.keySlots[i];
+        if (!(slot.flags & KEY_SLOT_USED)) continue;
+
+        SecByteBlock kek = slotKey(slot);
+        SecByteBlock key(KEY_SIZE);
+        auto cipher = makeCipher(header.algoType, false, kek, slot.nonce);
+        if (cipher->DecryptAndVerify(key, slot.wrappedKey + KEY_SIZE, AUTH_TAG_SIZE,
+                slot.nonce, NONCE_SIZE, seg.fileSalt, FILE_SALT_SIZE, slot.wrappedKey, KEY_SIZE)) {
+            dataKey = key;
+            return i;
+        }
+    }
+    dataKey.CleanNew(0);
+    return -1;
+}
+
+void KeySession::setKdfProfile(const KdfProfile& profile) {
+    std::lock_guard<std::mutex> lock(mutex);
+    parallelism = (profile.parallelism == 0) ? 1 : profile.parallelism;
+    kdfCost = profile.cost;
+    kdfBlockSize = profile.blockSize;
+}
+
+void KeySession::prepareHeader(SFMHeader& header, SegmentHeader& seg) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::memcpy(header.kdfSalt, sessionSalt, SALT_SIZE);
+    header.kdfMemoryCost = kdfCost;
+    header.kdfIterations = kdfBlockSize;
+    seg.kdfParallelism = parallelism;
+}
+
+void KeySession::warm() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (unlocked) deriveLocked(sessionSalt, kdfCost, kdfBlockSize, parallelism);
+}
@@ -0,0 +1,59 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <cstdint>
+#include <cryptopp/secblock.h>
+#include "functions.h"
+#include "segments.h"
+
+#define KEY_SIZE 32
+
+// Keeps the password-derived keys of one unlock so scrypt runs once per salt instead of once per file.
+// New files get a random key of their own, wrapped in a key slot under the session's scrypt key
+// (see KeySlot in segments.h). Files from before key slots derive theirs through HKDF instead.
+class KeySession {
+public:
+    KeySession();
+    ~KeySession();
+
+    void setPassword(const std::string& password); // cached keys are dropped if the password changes
+    void clear();
+    bool hasPassword();
+
+    // scrypt(password, header salt / cost / parallelism), derived on first use and cached
+    CryptoPP::SecByteBlock masterKey(const SFMHeader& header, uint32_t parallelism = 1);
+    bool isCached(const SFMHeader& header, uint32_t parallelism = 1); // masterKey would not run scrypt
+    // the key the segments are sealed with, whatever seg.keyMode. empty if no key slot opens
+    CryptoPP::SecByteBlock fileKey(const SFMHeader& header, const SegmentHeader& seg);
+
+    // random file key wrapped into slot 0 of a KEY_MODE_WRAPPED header
+    CryptoPP::SecByteBlock newDataKey(const SFMHeader& header, SegmentHeader& seg);
+    // wraps dataKey into seg.keySlots[slot] under this session's password and scrypt cost
+    void wrapKey(const SFMHeader& header, SegmentHeader& seg, int slot, const CryptoPP::SecByteBlock& dataKey);
+    // the slot this session's password opens (dataKey filled in), -1 if none
+    int unwrapKey(const SFMHeader& header, const SegmentHeader& seg, CryptoPP::SecByteBlock& dataKey);
+
+    // scrypt cost and lanes used for new headers and key slots
+    void setKdfProfile(const KdfProfile& profile);
+    // puts the session salt and parallelism into fresh headers so their master key is already cached
+    void prepareHeader(SFMHeader& header, SegmentHeader& seg);
+    void warm(); // runs the scrypt new files will need now, so the first encrypt does not wait for it
+
+private:
+    std::mutex mutex;
+    CryptoPP::SecByteBlock password;
+    bool unlocked;
+    uint8_t sessionSalt[SALT_SIZE];
+    uint32_t parallelism;
+    uint32_t kdfCost;
+    uint32_t kdfBlockSize;
+    std::map<std::string, CryptoPP::SecByteBlock> masterKeys;
+
+    CryptoPP::SecByteBlock deriveLocked(const uint8_t* salt, uint32_t cost, uint32_t blockSize, uint32_t parallelism);
+    CryptoPP::SecByteBlock slotKey(const KeySlot& slot); // HKDF of the slot's scrypt key
+};
+
+#endif
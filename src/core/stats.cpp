@@ -0,0 +1,118 @@
+#include "stats.h"
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+struct TraceEvent {
+    const char* name;
+    uint64_t thread;
+    uint64_t startUs;
+    uint64_t durationUs;
+};
+
+static std::atomic<uint64_t> counters[STAT_COUNT];
+static std::atomic<int64_t> wallStart(std::chrono::steady_clock::now().time_since_epoch().count());
+
+static std::atomic<bool> tracing(false);
+static std::mutex traceMutex;
+static std::string tracePath;
+static std::vector<TraceEvent> traceEvents;
+static std::chrono::steady_clock::time_point traceStart;
+
+void statAdd(StatCounter counter, uint64_t value) {
+    counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t statGet(StatCounter counter) {
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+void statsReset() {
+    for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+    wallStart = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+static double millis(StatCounter counter) {
+    return statGet(counter) / 1e6;
+}
+
+static double wallMillis() {
+    int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    std::chrono::steady_clock::duration elapsed(now - wallStart.load());
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+std::string statsJson() {
+    std::ostringstream out;
+    out << "{\"wall_ms\":" << wallMillis()
+        << ",\"kdf_ms\":" << millis(STAT_KDF_NS) << ",\"kdf_calls\":" << statGet(STAT_KDF_CALLS)
+        << ",\"read_ms\":" << millis(STAT_READ_NS) << ",\"bytes_read\":" << statGet(STAT_BYTES_READ)
+        << ",\"crypto_ms\":" << millis(STAT_CRYPTO_NS) << ",\"crypto_bytes\":" << statGet(STAT_CRYPTO_BYTES)
+        << ",\"write_ms\":" << millis(STAT_WRITE_NS) << ",\"bytes_written\":" << statGet(STAT_BYTES_WRITTEN)
+        << ",\"sync_ms\":" << millis(STAT_SYNC_NS) << ",\"syncs\":" << statGet(STAT_SYNC_CALLS)
+        << ",\"wipe_ms\":" << millis(STAT_WIPE_NS) << ",\"wipe_passes\":" << statGet(STAT_WIPE_PASSES) << ",\"wipe_bytes\":" << statGet(STAT_WIPE_BYTES) << "}";
+    return out.str();
+}
+
+std::string statsSummary() {
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(1);
+    out << "kdf " << millis(STAT_KDF_NS) << " ms | in " << statGet(STAT_BYTES_READ) / (1024.0 * 1024.0)
+        << " MB | crypto " << millis(STAT_CRYPTO_NS) << " ms | out " << statGet(STAT_BYTES_WRITTEN) / (1024.0 * 1024.0)
+        << " MB | sync " << millis(STAT_SYNC_NS) << " ms";
+    if (statGet(STAT_WIPE_PASSES) > 0) out << " | wipe " << statGet(STAT_WIPE_PASSES) << "x " << millis(STAT_WIPE_NS) << " ms";
+    return out.str();
+}
+
+bool startTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    std::ofstream probe(path, std::ios::trunc);
+    if (!probe.is_open()) return false;
+    tracePath = path;
+    traceEvents.clear();
+    traceStart = std::chrono::steady_clock::now();
+    tracing = true;
+    return true;
+}
+
+bool isTracing() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+bool stopTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (!tracing) return true;
+    tracing = false;
+
+    std::ofstream out(tracePath, std::ios::trunc);
+    out << "{\"traceEvents\":[";
+    for (size_t i = 0; i < traceEvents.size(); i++) {
+        const TraceEvent& e = traceEvents[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.thread
+            << ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs << "}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    traceEvents.clear();
+    return out.good();
+}
+
+StatTimer::StatTimer(StatCounter c, const char* n) : counter(c), name(n), start(std::chrono::steady_clock::now()) { }
+
+StatTimer::~StatTimer() {
+    auto end = std::chrono::steady_clock::now();
+    statAdd(counter, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    if (!isTracing()) return;
+
+    // spans are per chunk / per file, a lock per span is fine
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (!tracing || start < traceStart) return;
+    uint64_t thread = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+    uint64_t startUs = std::chrono::duration_cast<std::chrono::microseconds>(start - traceStart).count();
+    uint64_t durationUs = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    traceEvents.push_back({name, thread, startUs, durationUs});
+}
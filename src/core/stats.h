@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Process-wide counters of where an operation spends its time. Timers are summed over every
+// thread, so with several workers crypto_ms can exceed the wall time. Updating one is a relaxed
+// atomic add, cheap enough to stay on in production.
+enum StatCounter {
+    STAT_KDF_NS,
+    STAT_KDF_CALLS,
+    STAT_READ_NS,     // pipeline read stage
+    STAT_BYTES_READ,
+    STAT_CRYPTO_NS,   // pipeline transform stage and vault segments: AEAD, plus (de)compression
+    STAT_CRYPTO_BYTES,
+    STAT_WRITE_NS,    // pipeline write stage
+    STAT_BYTES_WRITTEN,
+    STAT_SYNC_NS,
+    STAT_SYNC_CALLS,
+    STAT_WIPE_NS,     // whole passes, their syncs included
+    STAT_WIPE_PASSES,
+    STAT_WIPE_BYTES,
+    STAT_COUNT
+};
+
+void statAdd(StatCounter counter, uint64_t value);
+uint64_t statGet(StatCounter counter);
+void statsReset(); // also restarts the wall clock statsJson reports
+
+std::string statsJson();    // one line, e.g. {"wall_ms":..,"kdf_ms":..,"bytes_read":..}
+std::string statsSummary(); // short human readable form for a status bar
+
+// Chrome trace (chrome://tracing, Perfetto): every StatTimer span while a trace is running
+bool startTrace(const std::string& path);
+bool stopTrace(); // writes the file, false if it could not be written
+bool isTracing();
+
+// adds the time from construction to destruction to a counter, and records a trace span
+class StatTimer {
+public:
+    StatTimer(StatCounter counter, const char* name);
+    ~StatTimer();
+
+private:
+    StatCounter counter;
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif
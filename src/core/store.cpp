@@ -0,0 +1,677 @@
+#include "store.h"
+#include "vault.h"
+#include "chunker.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <ostream>
+#include <set>
+
+#include <cryptopp/osrng.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha.h>
+
+#define STORE_IO_CHUNK (1024 * 1024)
+
+uint64_t hashFileName(const std::string& name) {
+    // FNV-1a, names never leave the encrypted vault so it does not need to be keyed
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+VaultStore::VaultStore(Vault& v) : vault(v), dirtyFirst(UINT64_MAX), dirtyLast(0), addWritten(0) {
+    std::memset(&super, 0, sizeof(VaultSuperblock));
+}
+
+bool VaultStore::fail(const std::string& message) {
+    lastError = message;
+    return false;
+}
+
+bool VaultStore::open() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!vault.read(0, reinterpret_cast<uint8_t*>(&super), sizeof(VaultSuperblock))) {
+        return fail("Incorrect password or corrupted vault.");
+    }
+
+    // a fresh vault reads as zeros
+    if (super.magic[0] == '\0') return format();
+    if (std::memcmp(super.magic, STORE_MAGIC, sizeof(STORE_MAGIC)) != 0) return fail("Vault has no file store.");
+    if (super.blockSize != STORE_BLOCK_SIZE || super.globalDepth > STORE_MAX_DEPTH) return fail("Corrupted superblock.");
+
+    std::vector<uint8_t> bitmap((super.blockCount + 7) / 8);
+    if (!vault.read(super.bitmapOffset, bitmap.data(), bitmap.size())) return fail("Could not read the allocation bitmap.");
+    allocator.reset(super.dataStart, super.blockCount, super.blockSize);
+    allocator.loadBitmap(bitmap);
+
+    directory.resize(static_cast<size_t>(1) << super.globalDepth);
+    if (!vault.read(super.directoryOffset, reinterpret_cast<uint8_t*>(directory.data()), directory.size() * sizeof(uint64_t))) {
+        return fail("Could not read the file index.");
+    }
+    return loadChunks();
+}
+
+bool VaultStore::format() {
+    uint64_t capacity = vault.capacity();
+    uint64_t totalBlocks = capacity / STORE_BLOCK_SIZE;
+    uint64_t bitmapBlocks = (totalBlocks / 8 + STORE_BLOCK_SIZE) / STORE_BLOCK_SIZE;
+    if (totalBlocks < bitmapBlocks + 4) return fail("Vault is too small for a file store.");
+
+    std::memset(&super, 0, sizeof(VaultSuperblock));
+    std::memcpy(super.magic, STORE_MAGIC, sizeof(STORE_MAGIC));
+    super.blockSize = STORE_BLOCK_SIZE;
+    super.bitmapOffset = STORE_BLOCK_SIZE;
+    super.dataStart = super.bitmapOffset + bitmapBlocks * STORE_BLOCK_SIZE;
+    super.blockCount = (capacity - super.dataStart) / STORE_BLOCK_SIZE;
+    allocator.reset(super.dataStart, super.blockCount, STORE_BLOCK_SIZE);
+
+    // one empty bucket that every hash maps to
+    Extent bucketExtent;
+    if (!allocator.allocateContiguous(sizeof(VaultBucket), bucketExtent)) return fail("Vault is full.");
+    VaultBucket bucket;
+    std::memset(&bucket, 0, sizeof(VaultBucket));
+    if (!writeBucket(bucketExtent.offset, bucket)) return false;
+
+    directory.assign(1, bucketExtent.offset);
+    CryptoPP::AutoSeededRandomPool prng;
+    prng.GenerateBlock(super.dedupKey, STORE_DEDUP_KEY_SIZE);
+    return saveDirectory() && saveBitmap() && writeSuper();
+}
+
+bool VaultStore::writeSuper() {
+    if (!vault.write(0, reinterpret_cast<const uint8_t*>(&super), sizeof(VaultSuperblock))) return fail("Could not write the superblock.");
+    return true;
+}
+
+bool VaultStore::saveDirectory() {
+    uint64_t needed = directory.size() * sizeof(uint64_t);
+    Extent old = {0, 0};
+    if (needed > super.directoryBytes) {
+        Extent grown;
+        if (!allocator.allocateContiguous(needed, grown)) return fail("Vault is full.");
+        old = {super.directoryOffset, super.directoryBytes};
+        super.directoryOffset = grown.offset;
+        super.directoryBytes = grown.length;
+    }
+    if (!vault.write(super.directoryOffset, reinterpret_cast<const uint8_t*>(directory.data()), needed)) {
+        return fail("Could not write the file index.");
+    }
+    // a moved directory is only given back once the superblock points at the new one
+    if (old.length > 0) {
+        if (!saveBitmap() || !writeSuper()) return false;
+        allocator.release(old);
+    }
+    return true;
+}
+
+bool VaultStore::saveBitmap() {
+    uint64_t first, last;
+    if (!allocator.takeDirty(first, last)) return true;
+    const std::vector<uint8_t>& bits = allocator.bitmap();
+    if (!vault.write(super.bitmapOffset + first, bits.data() + first, last - first + 1)) {
+        return fail("Could not write the allocation bitmap.");
+    }
+    return true;
+}
+
+bool VaultStore::flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return saveBitmap() && writeSuper() && vault.flush();
+}
+
+bool VaultStore::readBucket(uint64_t offset, VaultBucket& bucket) {
+    if (!vault.read(offset, reinterpret_cast<uint8_t*>(&bucket), sizeof(VaultBucket))) return fail("Could not read an index bucket.");
+    if (bucket.count > STORE_BUCKET_ENTRIES) return fail("Corrupted index bucket.");
+    return true;
+}
+
+bool VaultStore::writeBucket(uint64_t offset, const VaultBucket& bucket) {
+    if (!vault.write(offset, reinterpret_cast<const uint8_t*>(&bucket), sizeof(VaultBucket))) return fail("Could not write an index bucket.");
+    return true;
+}
+
+bool VaultStore::find(const std::string& name, uint64_t hash, VaultBucket& bucket, uint64_t& bucketOffset, int& slot) {
+    uint64_t mask = (static_cast<uint64_t>(1) << super.globalDepth) - 1;
+    bucketOffset = directory[hash & mask];
+    if (!readBucket(bucketOffset, bucket)) return false;
+
+    for (uint32_t i = 0; i < bucket.count; i++) {
+        const VaultFileEntry& e = bucket.entries[i];
+        if (e.nameHash == hash && std::strncmp(e.name, name.c_str(), STORE_NAME_SIZE) == 0) {
+            slot = static_cast<int>(i);
+            return true;
+        }
+    }
+    slot = -1;
+    return true;
+}
+
+bool VaultStore::splitBucket(uint64_t slotIndex) {
+    uint64_t offset = directory[slotIndex];
+    VaultBucket full;
+    if (!readBucket(offset, full)) return false;
+    if (full.localDepth >= STORE_MAX_DEPTH) return fail("Too many names with the same hash.");
+
+    if (full.localDepth == super.globalDepth) {
+        // double the directory, the new upper half points at the same buckets as the lower half
+        size_t oldSize = directory.size();
+        directory.resize(oldSize * 2);
+        std::copy(directory.begin(), directory.begin() + oldSize, directory.begin() + oldSize);
+        super.globalDepth++;
+    }
+
+    Extent sibling;
+    if (!allocator.allocateContiguous(sizeof(VaultBucket), sibling)) return fail("Vault is full.");
+
+    uint32_t depth = full.localDepth + 1;
+    uint64_t bit = static_cast<uint64_t>(1) << (depth - 1);
+
+    VaultBucket keep, moved;
+    std::memset(&keep, 0, sizeof(VaultBucket));
+    std::memset(&moved, 0, sizeof(VaultBucket));
+    keep.localDepth = moved.localDepth = depth;
+    for (uint32_t i = 0; i < full.count; i++) {
+        VaultBucket& target = (full.entries[i].nameHash & bit) ? moved : keep;
+        target.entries[target.count++] = full.entries[i];
+    }
+
+    for (size_t i = 0; i < directory.size(); i++) {
+        if (directory[i] == offset && (i & bit)) directory[i] = sibling.offset;
+    }
+
+    // the moved half goes out first and the full bucket is only cut down once the directory and the
+    // superblock point at both, a crash in between leaves entries in two buckets but never in none
+    return writeBucket(sibling.offset, moved) && saveBitmap() && saveDirectory() && writeSuper() &&
+           writeBucket(offset, keep);
+}
+
+bool VaultStore::insert(const VaultFileEntry& entry) {
+    while (true) {
+        uint64_t mask = (static_cast<uint64_t>(1) << super.globalDepth) - 1;
+        uint64_t slotIndex = entry.nameHash & mask;
+        uint64_t offset = directory[slotIndex];
+
+        VaultBucket bucket;
+        if (!readBucket(offset, bucket)) return false;
+        if (bucket.count < STORE_BUCKET_ENTRIES) {
+            bucket.entries[bucket.count++] = entry;
+            return writeBucket(offset, bucket);
+        }
+        if (!splitBucket(slotIndex)) return false;
+    }
+}
+
+bool VaultStore::readExtents(const VaultFileEntry& entry, std::vector<Extent>& extents) {
+    extents.resize(entry.mapCount);
+    if (entry.mapCount == 0) return true;
+    if (!vault.read(entry.mapOffset, reinterpret_cast<uint8_t*>(extents.data()), extents.size() * sizeof(Extent))) {
+        return fail("Could not read the extent list of " + std::string(entry.name));
+    }
+    return true;
+}
+
+bool VaultStore::readChunkList(const VaultFileEntry& entry, std::vector<uint32_t>& ids) {
+    ids.resize(entry.mapCount);
+    if (entry.mapCount == 0) return true;
+    if (!vault.read(entry.mapOffset, reinterpret_cast<uint8_t*>(ids.data()), ids.size() * sizeof(uint32_t))) {
+        return fail("Could not read the chunk list of " + std::string(entry.name));
+    }
+    return true;
+}
+
+void VaultStore::releaseFile(const VaultFileEntry& entry) {
+    if (entry.flags & VAULT_FILE_CHUNKED) {
+        std::vector<uint32_t> ids;
+        if (!readChunkList(entry, ids)) return;
+        for (uint32_t id : ids) releaseChunk(id);
+        if (entry.mapCount > 0) allocator.release({entry.mapOffset, entry.mapCount * sizeof(uint32_t)});
+        return;
+    }
+
+    // files added before dedup own their extents
+    std::vector<Extent> extents;
+    if (!readExtents(entry, extents)) return;
+    for (const Extent& e : extents) allocator.release(e);
+    if (entry.mapCount > 0) allocator.release({entry.mapOffset, entry.mapCount * sizeof(Extent)});
+}
+
+bool VaultStore::loadChunks() {
+    chunks.clear();
+    chunkIndex.clear();
+    freeSlots.clear();
+    if (super.chunkSlots > super.chunkTableBytes / sizeof(ChunkRecord)) return fail("Corrupted chunk table.");
+
+    chunks.resize(super.chunkSlots);
+    if (!chunks.empty() &&
+        !vault.read(super.chunkTableOffset, reinterpret_cast<uint8_t*>(chunks.data()), chunks.size() * sizeof(ChunkRecord))) {
+        return fail("Could not read the chunk table.");
+    }
+    for (uint32_t id = 0; id < chunks.size(); id++) {
+        if (chunks[id].refs == 0) {
+            freeSlots.push_back(id);
+        } else {
+            chunkIndex[std::string(reinterpret_cast<const char*>(chunks[id].hash), STORE_CHUNK_HASH_SIZE)] = id;
+        }
+    }
+
+    // stores formatted before dedup get their key now, it is written with the superblock on the first add
+    static const uint8_t zeros[STORE_DEDUP_KEY_SIZE] = {0};
+    if (std::memcmp(super.dedupKey, zeros, STORE_DEDUP_KEY_SIZE) == 0) {
+        CryptoPP::AutoSeededRandomPool prng;
+        prng.GenerateBlock(super.dedupKey, STORE_DEDUP_KEY_SIZE);
+    }
+    return true;
+}
+
+void VaultStore::markChunk(uint32_t id) {
+    dirtyFirst = std::min<uint64_t>(dirtyFirst, id);
+    dirtyLast = std::max<uint64_t>(dirtyLast, id);
+}
+
+bool VaultStore::saveChunks() {
+    if (dirtyFirst == UINT64_MAX) return true;
+
+    uint64_t needed = chunks.size() * sizeof(ChunkRecord);
+    uint64_t first = dirtyFirst;
+    uint64_t last = dirtyLast;
+    Extent old = {0, 0};
+    if (needed > super.chunkTableBytes) {
+        // moves like the directory, with room to grow so it is not copied on every add
+        Extent grown;
+        if (!allocator.allocateContiguous(needed * 2, grown)) return fail("Vault is full.");
+        old = {super.chunkTableOffset, super.chunkTableBytes};
+        super.chunkTableOffset = grown.offset;
+        super.chunkTableBytes = grown.length;
+        first = 0;
+        last = chunks.size() - 1;
+    }
+    uint64_t slotsOnDisk = super.chunkSlots;
+    super.chunkSlots = chunks.size();
+
+    if (!vault.write(super.chunkTableOffset + first * sizeof(ChunkRecord), reinterpret_cast<const uint8_t*>(&chunks[first]),
+                     (last - first + 1) * sizeof(ChunkRecord))) {
+        return fail("Could not write the chunk table.");
+    }
+    dirtyFirst = UINT64_MAX;
+    dirtyLast = 0;
+    // the superblock has to know a moved or longer table before any bucket names the new slots
+    if (old.length > 0 || super.chunkSlots != slotsOnDisk) {
+        if (!saveBitmap() || !writeSuper()) return false;
+        if (old.length > 0) allocator.release(old);
+    }
+    return true;
+}
+
+bool VaultStore::storeChunk(const uint8_t* data, size_t len, uint32_t& id) {
+    // keyed, so equal chunks can be found without the ids saying anything about their contents
+    ChunkRecord record;
+    std::memset(&record, 0, sizeof(ChunkRecord));
+    CryptoPP::HMAC<CryptoPP::SHA256> mac(super.dedupKey, STORE_DEDUP_KEY_SIZE);
+    mac.Update(data, len);
+    mac.Final(record.hash);
+
+    std::string key(reinterpret_cast<const char*>(record.hash), STORE_CHUNK_HASH_SIZE);
+    auto it = chunkIndex.find(key);
+    if (it != chunkIndex.end() && chunks[it->second].length == len) {
+        id = it->second;
+        chunks[id].refs++;
+        markChunk(id);
+        return true;
+    }
+
+    Extent extent;
+    if (!allocator.allocateContiguous(len, extent)) return fail("Not enough free space in the vault.");
+    if (!vault.write(extent.offset, data, len)) {
+        allocator.release(extent);
+        return fail("Could not write a chunk.");
+    }
+    addWritten += len;
+
+    record.offset = extent.offset;
+    record.length = static_cast<uint32_t>(len);
+    record.refs = 1;
+    if (freeSlots.empty()) {
+        id = static_cast<uint32_t>(chunks.size());
+        chunks.push_back(record);
+    } else {
+        id = freeSlots.back();
+        freeSlots.pop_back();
+        chunks[id] = record;
+    }
+    chunkIndex[key] = id;
+    markChunk(id);
+    return true;
+}
+
+void VaultStore::releaseChunk(uint32_t id) {
+    if (id >= chunks.size() || chunks[id].refs == 0) return;
+    ChunkRecord& record = chunks[id];
+    markChunk(id);
+    if (--record.refs > 0) return;
+
+    allocator.release({record.offset, record.length});
+    chunkIndex.erase(std::string(reinterpret_cast<const char*>(record.hash), STORE_CHUNK_HASH_SIZE));
+    freeSlots.push_back(id);
+}
+
+bool VaultStore::storeRange(const StoreReader& read, uint64_t from, uint64_t length, std::vector<uint32_t>& ids) {
+    std::vector<uint8_t> buffer(STORE_IO_CHUNK);
+    size_t avail = 0;
+    uint64_t left = length;
+    while (left > 0 || avail > 0) {
+        size_t want = static_cast<size_t>(std::min<uint64_t>(buffer.size() - avail, left));
+        if (want > 0) {
+            if (!read(from + length - left, buffer.data() + avail, want)) return fail("Could not read the data to store.");
+            avail += want;
+            left -= want;
+        }
+
+        // a short tail is only cut once the input has ended, it may still grow into a full chunk
+        size_t pos = 0;
+        while (avail - pos >= CDC_MAX_CHUNK || (left == 0 && pos < avail)) {
+            size_t len = findChunkEnd(buffer.data() + pos, avail - pos);
+            uint32_t id;
+            if (!storeChunk(buffer.data() + pos, len, id)) return false;
+            ids.push_back(id);
+            pos += len;
+        }
+        std::memmove(buffer.data(), buffer.data() + pos, avail - pos);
+        avail -= pos;
+    }
+    return true;
+}
+
+bool VaultStore::writeChunkList(VaultFileEntry& entry, const std::vector<uint32_t>& ids) {
+    entry.mapCount = static_cast<uint32_t>(ids.size());
+    entry.mapOffset = 0;
+    if (ids.empty()) return true;
+
+    Extent map;
+    if (!allocator.allocateContiguous(ids.size() * sizeof(uint32_t), map)) return fail("Not enough free space in the vault.");
+    entry.mapOffset = map.offset;
+    if (!vault.write(map.offset, reinterpret_cast<const uint8_t*>(ids.data()), ids.size() * sizeof(uint32_t))) {
+        allocator.release(map);
+        return fail("Could not write the chunk list.");
+    }
+    return true;
+}
+
+bool VaultStore::add(const std::string& name, std::istream& in, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (name.empty() || name.size() >= STORE_NAME_SIZE) return fail("Name must be 1 to 199 characters.");
+
+    uint64_t hash = hashFileName(name);
+    VaultBucket bucket;
+    uint64_t bucketOffset;
+    int slot;
+    if (!find(name, hash, bucket, bucketOffset, slot)) return false;
+    if (slot >= 0) return fail("A file with that name already exists: " + name);
+
+    // cut into chunks as it streams in, chunks the vault already holds only gain a reference
+    std::vector<uint32_t> ids;
+    auto rollback = [&]() {
+        for (uint32_t id : ids) releaseChunk(id);
+    };
+
+    addWritten = 0;
+    auto readIn = [&](uint64_t, uint8_t* data, size_t len) {
+        in.read(reinterpret_cast<char*>(data), len);
+        return static_cast<size_t>(in.gcount()) == len;
+    };
+    if (!storeRange(readIn, 0, size, ids)) {
+        rollback();
+        if (!in) return fail("Could not copy " + name + " into the vault.");
+        return false;
+    }
+
+    VaultFileEntry entry;
+    std::memset(&entry, 0, sizeof(VaultFileEntry));
+    std::strncpy(entry.name, name.c_str(), STORE_NAME_SIZE - 1);
+    entry.size = size;
+    entry.flags = VAULT_FILE_USED | VAULT_FILE_CHUNKED;
+    entry.nameHash = hash;
+    entry.modified = static_cast<uint64_t>(std::time(nullptr));
+    if (!writeChunkList(entry, ids)) {
+        rollback();
+        return false;
+    }
+
+    // chunks, chunk table and bitmap reach the vault before the bucket names them and the superblock
+    // last, a crash in between leaks space but never leaves an entry pointing at free or reused chunks
+    if (!saveChunks() || !saveBitmap() || !insert(entry)) {
+        rollback();
+        if (entry.mapCount > 0) allocator.release({entry.mapOffset, entry.mapCount * sizeof(uint32_t)});
+        saveChunks();
+        saveBitmap();
+        return false;
+    }
+
+    super.fileCount++;
+    return saveBitmap() && writeSuper();
+}
+
+bool VaultStore::update(const std::string& name, uint64_t size, const std::vector<Extent>& dirty, const StoreReader& read) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VaultBucket bucket;
+    uint64_t bucketOffset;
+    int slot;
+    if (!find(name, hashFileName(name), bucket, bucketOffset, slot)) return false;
+    if (slot < 0) return fail("No such file in the vault: " + name);
+    VaultFileEntry entry = bucket.entries[slot];
+
+    // files added before dedup have no chunks to keep, they are cut as a whole
+    std::vector<uint32_t> oldIds;
+    if ((entry.flags & VAULT_FILE_CHUNKED) && !readChunkList(entry, oldIds)) return false;
+
+    // every id in the new list holds a reference of its own, kept chunks included, so the old
+    // list is released as a whole at the end and a failure releases the new one
+    std::vector<uint32_t> ids;
+    auto rollback = [&]() {
+        for (uint32_t id : ids) releaseChunk(id);
+    };
+
+    // writes never move bytes, a kept chunk sits at the same file offset as before.
+    // consecutive touched chunks are cut again together, from the first one's start
+    addWritten = 0;
+    uint64_t pos = 0;
+    uint64_t runStart = UINT64_MAX;
+    size_t d = 0;
+    for (uint32_t id : oldIds) {
+        if (pos >= size) break;
+        if (id >= chunks.size() || chunks[id].refs == 0) {
+            rollback();
+            return fail("Chunk list of " + name + " is corrupted.");
+        }
+        uint64_t end = pos + chunks[id].length;
+        while (d < dirty.size() && dirty[d].offset + dirty[d].length <= pos) d++;
+        bool touched = end > size || (d < dirty.size() && dirty[d].offset < end);
+
+        if (touched) {
+            if (runStart == UINT64_MAX) runStart = pos;
+        } else {
+            if (runStart != UINT64_MAX && !storeRange(read, runStart, pos - runStart, ids)) {
+                rollback();
+                return false;
+            }
+            runStart = UINT64_MAX;
+            chunks[id].refs++;
+            markChunk(id);
+            ids.push_back(id);
+        }
+        pos = end;
+    }
+    // touched chunks at the end, and whatever grew past the old end
+    if (runStart == UINT64_MAX && pos < size) runStart = pos;
+    if (runStart != UINT64_MAX && !storeRange(read, runStart, size - runStart, ids)) {
+        rollback();
+        return false;
+    }
+
+    VaultFileEntry updated = entry;
+    updated.size = size;
+    updated.flags = VAULT_FILE_USED | VAULT_FILE_CHUNKED;
+    updated.modified = static_cast<uint64_t>(std::time(nullptr));
+    if (!writeChunkList(updated, ids)) {
+        rollback();
+        return false;
+    }
+
+    // the new chunks are on record before the entry changes in one bucket write, the old ones are
+    // only let go after it (same order as add)
+    bucket.entries[slot] = updated;
+    if (!saveChunks() || !saveBitmap() || !writeBucket(bucketOffset, bucket)) {
+        rollback();
+        if (updated.mapCount > 0) allocator.release({updated.mapOffset, updated.mapCount * sizeof(uint32_t)});
+        saveChunks();
+        saveBitmap();
+        return false;
+    }
+    releaseFile(entry);
+    return saveChunks() && saveBitmap() && writeSuper();
+}
+
+bool VaultStore::lookup(const std::string& name, VaultFileEntry& entry) {
+    std::lock_guard<std::mutex> lock(mutex);
+    VaultBucket bucket;
+    uint64_t bucketOffset;
+    int slot;
+    if (!find(name, hashFileName(name), bucket, bucketOffset, slot)) return false;
+    if (slot < 0) return fail("No such file in the vault: " + name);
+    entry = bucket.entries[slot];
+    return true;
+}
+
+bool VaultStore::extract(const std::string& name, std::ostream& out) {
+    VaultFileEntry entry;
+    if (!lookup(name, entry)) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint8_t> buffer(STORE_IO_CHUNK);
+    uint64_t left = entry.size;
+
+    if (entry.flags & VAULT_FILE_CHUNKED) {
+        std::vector<uint32_t> ids;
+        if (!readChunkList(entry, ids)) return false;
+        for (uint32_t id : ids) {
+            if (id >= chunks.size() || chunks[id].refs == 0 || chunks[id].length > left || chunks[id].length > buffer.size()) {
+                return fail("Chunk list of " + name + " is corrupted.");
+            }
+            const ChunkRecord& record = chunks[id];
+            if (!vault.read(record.offset, buffer.data(), record.length)) return fail("Could not read " + name + " from the vault.");
+            out.write(reinterpret_cast<const char*>(buffer.data()), record.length);
+            left -= record.length;
+        }
+        if (left != 0) return fail("Chunk list of " + name + " is too short.");
+        return out.good() || fail("Could not write the extracted file.");
+    }
+
+    std::vector<Extent> extents;
+    if (!readExtents(entry, extents)) return false;
+    for (const Extent& e : extents) {
+        uint64_t pos = e.offset;
+        uint64_t inExtent = std::min(e.length, left);
+        while (inExtent > 0) {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(inExtent, buffer.size()));
+            if (!vault.read(pos, buffer.data(), chunk)) return fail("Could not read " + name + " from the vault.");
+            out.write(reinterpret_cast<const char*>(buffer.data()), chunk);
+            pos += chunk;
+            inExtent -= chunk;
+            left -= chunk;
+        }
+    }
+    if (left != 0) return fail("Extent list of " + name + " is too short.");
+    return out.good() || fail("Could not write the extracted file.");
+}
+
+bool VaultStore::remove(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    VaultBucket bucket;
+    uint64_t bucketOffset;
+    int slot;
+    if (!find(name, hashFileName(name), bucket, bucketOffset, slot)) return false;
+    if (slot < 0) return fail("No such file in the vault: " + name);
+
+    releaseFile(bucket.entries[slot]);
+    bucket.entries[slot] = bucket.entries[bucket.count - 1];
+    std::memset(&bucket.entries[bucket.count - 1], 0, sizeof(VaultFileEntry));
+    bucket.count--;
+    if (!writeBucket(bucketOffset, bucket)) return false;
+
+    super.fileCount--;
+    return saveChunks() && saveBitmap() && writeSuper();
+}
+
+bool VaultStore::rename(const std::string& from, const std::string& to) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (to.empty() || to.size() >= STORE_NAME_SIZE) return fail("Name must be 1 to 199 characters.");
+
+    VaultBucket bucket;
+    uint64_t bucketOffset;
+    int slot;
+    if (!find(to, hashFileName(to), bucket, bucketOffset, slot)) return false;
+    if (slot >= 0) return fail("A file with that name already exists: " + to);
+    if (!find(from, hashFileName(from), bucket, bucketOffset, slot)) return false;
+    if (slot < 0) return fail("No such file in the vault: " + from);
+
+    // the new name may hash to another bucket, so it is taken out and inserted again
+    VaultFileEntry entry = bucket.entries[slot];
+    bucket.entries[slot] = bucket.entries[bucket.count - 1];
+    std::memset(&bucket.entries[bucket.count - 1], 0, sizeof(VaultFileEntry));
+    bucket.count--;
+    if (!writeBucket(bucketOffset, bucket)) return false;
+
+    std::memset(entry.name, 0, STORE_NAME_SIZE);
+    std::strncpy(entry.name, to.c_str(), STORE_NAME_SIZE - 1);
+    entry.nameHash = hashFileName(to);
+    return insert(entry) && saveBitmap() && writeSuper();
+}
+
+bool VaultStore::layout(const VaultFileEntry& entry, std::vector<Extent>& pieces) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pieces.clear();
+    uint64_t left = entry.size;
+
+    if (entry.flags & VAULT_FILE_CHUNKED) {
+        std::vector<uint32_t> ids;
+        if (!readChunkList(entry, ids)) return false;
+        for (uint32_t id : ids) {
+            if (id >= chunks.size() || chunks[id].refs == 0 || chunks[id].length > left) {
+                return fail("Chunk list of " + std::string(entry.name) + " is corrupted.");
+            }
+            pieces.push_back({chunks[id].offset, chunks[id].length});
+            left -= chunks[id].length;
+        }
+    } else {
+        std::vector<Extent> extents;
+        if (!readExtents(entry, extents)) return false;
+        for (const Extent& e : extents) {
+            uint64_t used = std::min(e.length, left);
+            if (used == 0) break;
+            pieces.push_back({e.offset, used});
+            left -= used;
+        }
+    }
+    if (left != 0) return fail("Map of " + std::string(entry.name) + " is too short.");
+    return true;
+}
+
+bool VaultStore::list(std::vector<VaultFileEntry>& entries) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // several directory slots can share a bucket, read each one once
+    std::set<uint64_t> seen;
+    for (uint64_t offset : directory) {
+        if (!seen.insert(offset).second) continue;
+        VaultBucket bucket;
+        if (!readBucket(offset, bucket)) return false;
+        entries.insert(entries.end(), bucket.entries, bucket.entries + bucket.count);
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "allocator.h"
+
+class Vault;
+
+// bytes [offset, offset + len) of the new contents of a file, see VaultStore::update
+typedef std::function<bool(uint64_t offset, uint8_t* data, size_t len)> StoreReader;
+
+#define STORE_MAGIC "SFMSTOR"
+#define STORE_BLOCK_SIZE 4096
+#define STORE_NAME_SIZE 200
+#define STORE_BUCKET_ENTRIES 15
+#define STORE_MAX_DEPTH 24
+#define STORE_CHUNK_HASH_SIZE 32
+#define STORE_DEDUP_KEY_SIZE 32
+
+#define VAULT_FILE_USED 1
+#define VAULT_FILE_CHUNKED 2 // mapOffset points at uint32_t chunk ids instead of extents
+
+// lives at offset 0 of the vault's plaintext space
+struct VaultSuperblock {
+    char magic[8];
+    uint32_t blockSize;
+    uint32_t globalDepth;    // the hash directory has 2^globalDepth slots
+    uint64_t fileCount;
+    uint64_t bitmapOffset;
+    uint64_t dataStart;
+    uint64_t blockCount;
+    uint64_t directoryOffset;
+    uint64_t directoryBytes; // space reserved for the directory, it moves when it outgrows it
+    // dedup, all zero in stores written before it (the table is created on the first add)
+    uint64_t chunkTableOffset; // ChunkRecord[chunkSlots]
+    uint64_t chunkTableBytes;
+    uint64_t chunkSlots;
+    uint8_t dedupKey[STORE_DEDUP_KEY_SIZE]; // HMAC key for chunk ids, random per vault
+};
+
+// one unique chunk, shared by every file whose chunk list names its slot
+struct ChunkRecord {
+    uint8_t hash[STORE_CHUNK_HASH_SIZE]; // HMAC-SHA256(dedupKey, chunk)
+    uint64_t offset;
+    uint32_t length;
+    uint32_t refs; // 0 = free slot
+};
+
+struct VaultFileEntry {
+    char name[STORE_NAME_SIZE];
+    uint64_t size;
+    uint64_t mapOffset; // Extent[mapCount]
+    uint32_t mapCount;
+    uint32_t flags;
+    uint64_t nameHash;
+    uint64_t modified;
+    uint8_t reserved[16];
+};
+
+// one allocation block, the unit the extendible hash splits
+struct VaultBucket {
+    uint32_t count;
+    uint32_t localDepth;
+    uint64_t reserved;
+    VaultFileEntry entries[STORE_BUCKET_ENTRIES];
+    uint8_t pad[STORE_BLOCK_SIZE - 16 - STORE_BUCKET_ENTRIES * sizeof(VaultFileEntry)];
+};
+
+// Files stored inside a vault. Names go into an extendible hash (directory of bucket
+// pointers, buckets split when full) so a lookup reads one bucket however many files there are.
+// Contents are cut into content-defined chunks (chunker.h), each unique chunk is stored once
+// and a file is a list of chunk ids. Space is allocated in extents from an ExtentAllocator.
+class VaultStore {
+public:
+    explicit VaultStore(Vault& vault);
+
+    bool open(); // formats a vault that has never been used as a store
+    bool flush();
+
+    bool add(const std::string& name, std::istream& in, uint64_t size);
+    // the file becomes size bytes long and changed only inside dirty (file ranges, sorted, not overlapping).
+    // chunks outside them are kept, the ones they touch are cut again from read, so an edit costs
+    // what it touches and not the whole file
+    bool update(const std::string& name, uint64_t size, const std::vector<Extent>& dirty, const StoreReader& read);
+    bool extract(const std::string& name, std::ostream& out);
+    bool remove(const std::string& name);
+    bool rename(const std::string& from, const std::string& to);
+    bool lookup(const std::string& name, VaultFileEntry& entry);
+    // where the file's bytes sit in the vault's plaintext space, in file order, covering exactly entry.size
+    bool layout(const VaultFileEntry& entry, std::vector<Extent>& pieces);
+    bool list(std::vector<VaultFileEntry>& entries);
+
+    uint64_t fileCount() const { return super.fileCount; }
+    uint64_t lastAddWritten() const { return addWritten; } // bytes the last add actually stored
+    uint64_t freeBytes() const { return allocator.freeBytes(); }
+    const std::string& error() const { return lastError; }
+
+private:
+    Vault& vault;
+    std::mutex mutex;
+    VaultSuperblock super;
+    ExtentAllocator allocator;
+    std::vector<uint64_t> directory; // bucket offsets, 2^globalDepth slots
+    std::string lastError;
+    std::vector<ChunkRecord> chunks;                   // the whole chunk table, read on open
+    std::unordered_map<std::string, uint32_t> chunkIndex; // hash -> slot
+    std::vector<uint32_t> freeSlots;
+    uint64_t dirtyFirst;
+    uint64_t dirtyLast;
+    uint64_t addWritten;
+
+    bool format();
+    bool writeSuper();
+    bool saveDirectory();
+    bool saveBitmap();
+
+    bool readBucket(uint64_t offset, VaultBucket& bucket);
+    bool writeBucket(uint64_t offset, const VaultBucket& bucket);
+    bool find(const std::string& name, uint64_t hash, VaultBucket& bucket, uint64_t& bucketOffset, int& slot);
+    bool insert(const VaultFileEntry& entry);
+    bool splitBucket(uint64_t slotIndex);
+
+    bool readExtents(const VaultFileEntry& entry, std::vector<Extent>& extents);
+    bool readChunkList(const VaultFileEntry& entry, std::vector<uint32_t>& ids);
+    void releaseFile(const VaultFileEntry& entry);
+
+    bool loadChunks();
+    bool saveChunks();
+    void markChunk(uint32_t id);
+    bool storeChunk(const uint8_t* data, size_t len, uint32_t& id); // dedups against the table
+    bool storeRange(const StoreReader& read, uint64_t from, uint64_t length, std::vector<uint32_t>& ids); // cut and stored
+    bool writeChunkList(VaultFileEntry& entry, const std::vector<uint32_t>& ids); // sets mapOffset / mapCount
+    void releaseChunk(uint32_t id);
+    bool fail(const std::string& message);
+};
+
+uint64_t hashFileName(const std::string& name);
+
+#endif
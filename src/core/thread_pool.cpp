@@ -0,0 +1,84 @@
+#include "thread_pool.h"
+
+WorkStealingPool::WorkStealingPool(int threads) : nextQueue(0), queued(0), pending(0), stopping(false) {
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; i++) queues.emplace_back(new Queue());
+    for (int i = 0; i < threads; i++) workers.emplace_back(&WorkStealingPool::run, this, static_cast<size_t>(i));
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) t.join();
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    // counted before it becomes visible so a fast worker can never finish it "early"
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        queued++;
+        pending++;
+    }
+    Queue& q = *queues[nextQueue++ % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    idle.wait(lock, [&]() { return pending == 0; });
+}
+
+bool WorkStealingPool::take(size_t self, std::function<void()>& task) {
+    {
+        Queue& own = *queues[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues.size(); i++) {
+        Queue& victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t self) {
+    while (true) {
+        std::function<void()> task;
+        if (take(self, task)) {
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                queued--;
+            }
+            try {
+                task();
+            } catch (...) {
+                // tasks report their own failures, a throw must not take the worker down
+            }
+
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (--pending == 0) idle.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(stateMutex);
+        wake.wait(lock, [&]() { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own deque. A worker takes from the back of its own
+// deque and steals from the front of the others once it runs dry, so one slow task
+// (a big file) does not hold up the small ones queued behind it.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads);
+    ~WorkStealingPool();
+
+    void submit(std::function<void()> task);
+    void wait(); // returns once every submitted task has finished
+    int size() const { return static_cast<int>(workers.size()); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue;
+
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t queued;  // tasks sitting in a deque
+    size_t pending; // queued + running
+    bool stopping;
+
+    bool take(size_t self, std::function<void()>& task);
+    void run(size_t self);
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "vault.h"
+#include "cipher.h"
+#include "progress.h"
+#include "session.h"
+#include "segment_cache.h"
+#include "stats.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include <cryptopp/osrng.h>
+#include <cryptopp/misc.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace CryptoPP;
+
+// version 3 only, kept to read those vaults
+static void deriveVaultNonce(const uint8_t* baseNonce, uint64_t index, uint32_t generation, uint8_t* out) {
+    deriveSegmentNonce(baseNonce, index, out);
+    for (int i = 0; i < 4; i++) {
+        out[i] ^= static_cast<uint8_t>(generation >> (8 * i));
+    }
+}
+
+static bool refuseReadOnly() {
+    std::cerr << "[Error] This vault was written by an older version and can only be read, "
+                 "extract its files and add them to a new vault.\n";
+    return false;
+}
+
+// reserves the space without writing it: fallocate where the filesystem supports it, a sparse file otherwise
+static bool preallocate(const std::string& path, uint64_t size) {
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd >= 0) {
+        int rc = ::fallocate(fd, 0, 0, static_cast<off_t>(size));
+        ::close(fd);
+        if (rc == 0) return true;
+    }
+#endif
+    std::error_code ec;
+    std::filesystem::resize_file(path, size, ec);
+    return !ec;
+}
+
+Vault::Vault() : tableOffset(0), dataOffset(0), counterNonces(false) {
+    std::memset(&header, 0, sizeof(SFMHeader));
+    std::memset(&seg, 0, sizeof(SegmentHeader));
+}
+
+Vault::~Vault() {
+    close();
+}
+
+bool Vault::setKey(const SecByteBlock& vaultKey) {
+    if (vaultKey.size() != KEY_SIZE) return false; // no key slot opened
+    key = vaultKey;
+    encryptor = makeCipher(header.algoType, true, key, header.encryptionNonce);
+    decryptor = makeCipher(header.algoType, false, key, header.encryptionNonce);
+    buffer.resize(slotSize());
+    return encryptor && decryptor;
+}
+
+bool Vault::create(const std::string& path, KeySession& session, SFMHeader header, uint64_t capacity, bool prefill,
+                   JobProgress* progress) {
+    AutoSeededRandomPool prng;
+    prng.GenerateBlock(header.encryptionNonce, NONCE_SIZE);
+    header.version = SFM_VERSION_VAULT;
+
+    SegmentHeader seg = createSegmentHeader(capacity);
+    seg.plainSize = seg.segmentCount * seg.segmentSize; // whole segments only
+    seg.keyMode = KEY_MODE_WRAPPED;
+    prng.GenerateBlock(seg.fileSalt, FILE_SALT_SIZE);
+    session.prepareHeader(header, seg);
+    SecByteBlock vaultKey = session.newDataKey(header, seg);
+
+    std::vector<VaultSegment> table(seg.segmentCount);
+    std::memset(table.data(), 0, table.size() * sizeof(VaultSegment));
+
+    uint64_t tableOffset = sizeof(SFMHeader) + sizeof(SegmentHeader);
+    uint64_t dataOffset = tableOffset + seg.segmentCount * sizeof(VaultSegment);
+    uint64_t fileSize = dataOffset + seg.segmentCount * (seg.segmentSize + VAULT_SLOT_OVERHEAD);
+
+    // from here on a failure removes the file, a half-written vault is not left behind
+    Vault vault;
+    auto abandon = [&]() {
+        vault.close();
+        std::remove(path.c_str());
+        return false;
+    };
+
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(SFMHeader));
+        out.write(reinterpret_cast<const char*>(&seg), sizeof(SegmentHeader));
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(VaultSegment));
+        if (!out.good()) {
+            out.close();
+            return abandon();
+        }
+    }
+
+    if (!preallocate(path, fileSize)) {
+        std::cerr << "[Error] Could not reserve " << fileSize << " bytes for the vault.\n";
+        return abandon();
+    }
+
+    try {
+        vault.file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!vault.file.is_open()) return abandon();
+        vault.header = header;
+        vault.seg = seg;
+        vault.table = table;
+        vault.tableOffset = tableOffset;
+        vault.dataOffset = dataOffset;
+        if (!vault.setKey(vaultKey)) return abandon();
+
+        // segment 0 (the vault index) is always written so there is a tag to check the password against
+        std::vector<uint8_t> zeros(seg.segmentSize, 0);
+        uint64_t upTo = prefill ? seg.segmentCount : 1;
+        if (progress) progress->begin("Writing vault", upTo * seg.segmentSize);
+        for (uint64_t i = 0; i < upTo; i++) {
+            if (progress && progress->cancelled()) return abandon();
+            if (!vault.writeSegment(i, zeros.data())) return abandon();
+            if (progress) progress->advance(seg.segmentSize);
+        }
+        if (!vault.flush()) return abandon();
+    } catch (...) {
+        abandon(); // a cipher that throws leaves the same half-written file
+        throw;
+    }
+    return true;
+}
+
+bool Vault::open(const std::string& path, KeySession& session) {
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open()) return false;
+
+    file.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader));
+    if (!file || (header.version != SFM_VERSION_VAULT && header.version != SFM_VERSION_VAULT_V3)) return false;
+    counterNonces = header.version == SFM_VERSION_VAULT_V3;
+    if (!readSegmentHeader(file, seg)) return false;
+
+    // the file is preallocated, so every segment's table entry and slot must fit in it. checked
+    // before anything is sized by the count, which also keeps the products below from overflowing
+    std::error_code ec;
+    uint64_t fileSize = std::filesystem::file_size(path, ec);
+    tableOffset = sizeof(SFMHeader) + seg.headerSize;
+    if (ec || tableOffset > fileSize ||
+        seg.segmentCount > (fileSize - tableOffset) / (sizeof(VaultSegment) + slotSize())) return false;
+    if (seg.plainSize != seg.segmentCount * seg.segmentSize) return false;
+
+    dataOffset = tableOffset + seg.segmentCount * sizeof(VaultSegment);
+
+    table.resize(seg.segmentCount);
+    file.seekg(tableOffset);
+    file.read(reinterpret_cast<char*>(table.data()), table.size() * sizeof(VaultSegment));
+    if (!file) return false;
+
+    return setKey(session.fileKey(header, seg));
+}
+
+void Vault::close() {
+    // dirty segments go out before the file closes, the cache writes through writeSegment
+    if (cache && !cache->flush()) std::cerr << "[Error] Could not write back cached segments.\n";
+    cache.reset();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open()) {
+        file.flush();
+        file.close();
+    }
+    key.CleanNew(0);
+    table.clear();
+}
+
+void Vault::enableCache(uint64_t bytes) {
+    if (!cache && seg.segmentSize > 0) cache.reset(new SegmentCache(*this, bytes));
+}
+
+bool Vault::checkKey(KeySession& session) {
+    SecByteBlock candidate = session.fileKey(header, seg);
+    std::lock_guard<std::mutex> lock(mutex);
+    return candidate.size() == key.size() && key.size() > 0 && VerifyBufsEqual(candidate, key, key.size());
+}
+
+bool Vault::isWritten(uint64_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index < table.size() && table[index].generation != 0;
+}
+
+bool Vault::readSegment(uint64_t index, uint8_t* plain) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index >= table.size()) return false;
+
+    file.seekg(dataOffset + index * slotSize());
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if (!file) {
+        file.clear();
+        return false;
+    }
+    statAdd(STAT_BYTES_READ, buffer.size());
+
+    // the table is not authenticated, so its entry alone cannot make a segment read as zeros.
+    // never written means the slot is still the preallocated zeros, anything else has to pass the tag.
+    // segment 0 is written when the vault is created, it never counts as empty
+    if (table[index].generation == 0) {
+        bool blank = std::all_of(buffer.begin(), buffer.end(), [](uint8_t b) { return b == 0; });
+        if (blank && index > 0) {
+            std::memset(plain, 0, seg.segmentSize);
+            return true;
+        }
+        if (counterNonces) return false; // the nonce needs the generation the entry lost
+    }
+
+    uint8_t derived[NONCE_SIZE];
+    const uint8_t* nonce = buffer.data();
+    const uint8_t* cipher = buffer.data() + NONCE_SIZE;
+    if (counterNonces) {
+        deriveVaultNonce(header.encryptionNonce, index, table[index].generation, derived);
+        nonce = derived;
+        cipher = buffer.data();
+    }
+    uint8_t aad[SEGMENT_AAD_SIZE];
+    buildSegmentAAD(seg, index, aad);
+
+    StatTimer timer(STAT_CRYPTO_NS, "open vault segment");
+    statAdd(STAT_CRYPTO_BYTES, seg.segmentSize);
+    return decryptor->DecryptAndVerify(plain, cipher + seg.segmentSize, AUTH_TAG_SIZE,
+        nonce, NONCE_SIZE, aad, SEGMENT_AAD_SIZE, cipher, seg.segmentSize);
+}
+
+bool Vault::writeSegment(uint64_t index, const uint8_t* plain) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return writeSegmentLocked(index, plain);
+}
+
+bool Vault::writeSegmentLocked(uint64_t index, const uint8_t* plain) {
+    if (index >= table.size()) return false;
+    if (counterNonces) return refuseReadOnly();
+
+    VaultSegment entry = table[index];
+    if (entry.generation < UINT32_MAX) entry.generation++; // only a written marker now, it may saturate
+
+    // 96 random bits per write (GCM's limit for random nonces is 2^32 writes per key)
+    uint8_t* nonce = buffer.data();
+    uint8_t* cipher = buffer.data() + NONCE_SIZE;
+    prng.GenerateBlock(nonce, NONCE_SIZE);
+    uint8_t aad[SEGMENT_AAD_SIZE];
+    buildSegmentAAD(seg, index, aad);
+
+    {
+        StatTimer timer(STAT_CRYPTO_NS, "seal vault segment");
+        statAdd(STAT_CRYPTO_BYTES, seg.segmentSize);
+        encryptor->EncryptAndAuthenticate(cipher, cipher + seg.segmentSize, AUTH_TAG_SIZE,
+            nonce, NONCE_SIZE, aad, SEGMENT_AAD_SIZE, plain, seg.segmentSize);
+    }
+
+    // nonce and ciphertext in one write, the table entry behind it only marks the segment as written
+    file.seekp(dataOffset + index * slotSize());
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+
+    file.seekp(tableOffset + index * sizeof(VaultSegment));
+    file.write(reinterpret_cast<const char*>(&entry), sizeof(VaultSegment));
+    if (!file) {
+        file.clear();
+        return false;
+    }
+    statAdd(STAT_BYTES_WRITTEN, buffer.size() + sizeof(VaultSegment));
+
+    table[index] = entry;
+    return true;
+}
+
+bool Vault::read(uint64_t offset, uint8_t* data, size_t len) {
+    if (offset + len > seg.plainSize) return false;
+    if (cache) return cache->read(offset, data, len);
+    if (scratch.size() != seg.segmentSize) scratch.CleanNew(seg.segmentSize);
+
+    bool ok = true;
+    while (ok && len > 0) {
+        uint64_t index = offset / seg.segmentSize;
+        size_t within = static_cast<size_t>(offset % seg.segmentSize);
+        size_t chunk = std::min<size_t>(len, seg.segmentSize - within);
+
+        if (within == 0 && chunk == seg.segmentSize) {
+            ok = readSegment(index, data);
+        } else {
+            ok = readSegment(index, scratch.data());
+            if (ok) std::memcpy(data, scratch.data() + within, chunk);
+        }
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    // a partial segment's plaintext does not stay behind in the scratch segment
+    SecureWipeBuffer(scratch.data(), scratch.size());
+    return ok;
+}
+
+bool Vault::write(uint64_t offset, const uint8_t* data, size_t len) {
+    if (offset + len > seg.plainSize) return false;
+    if (counterNonces) return refuseReadOnly(); // the cache would take it and only fail at flush
+    if (cache) return cache->write(offset, data, len);
+    if (scratch.size() != seg.segmentSize) scratch.CleanNew(seg.segmentSize);
+
+    bool ok = true;
+    while (ok && len > 0) {
+        uint64_t index = offset / seg.segmentSize;
+        size_t within = static_cast<size_t>(offset % seg.segmentSize);
+        size_t chunk = std::min<size_t>(len, seg.segmentSize - within);
+
+        if (within == 0 && chunk == seg.segmentSize) {
+            ok = writeSegment(index, data);
+        } else {
+            ok = readSegment(index, scratch.data());
+            if (ok) std::memcpy(scratch.data() + within, data, chunk);
+            ok = ok && writeSegment(index, scratch.data());
+        }
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    SecureWipeBuffer(scratch.data(), scratch.size());
+    return ok;
+}
+
+bool Vault::flush() {
+    if (cache && !cache->flush()) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    file.flush();
+    return file.good();
+}
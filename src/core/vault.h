@@ -0,0 +1,93 @@
+#ifndef VAULT_H
+#define VAULT_H
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/secblock.h>
+
+#include "functions.h"
+#include "segments.h"
+
+class JobProgress;
+class KeySession;
+class SegmentCache;
+
+// vault layout (version 4):
+// SFMHeader | SegmentHeader | VaultSegment[segmentCount] | slot 0 | slot 1 | ...
+// a slot is nonce | ciphertext | tag at a fixed stride, so segments can be rewritten in place.
+// Every write draws a fresh random nonce and stores it in the slot, in the same write as the
+// ciphertext. The table is not authenticated and reaches the disk after the data, so nothing in
+// it may feed the nonce: a crash between the two writes or a rolled back entry must not repeat one.
+// Version 3 vaults derived the nonce from the generation counter, they are only opened for reading.
+// Unwritten slots stay all zeros (a sealed slot never is), and only such a slot reads back as zeros:
+// zeroing a table entry does not hide a segment, its slot is still decrypted and checked.
+#define VAULT_SLOT_OVERHEAD (NONCE_SIZE + AUTH_TAG_SIZE)
+
+struct VaultSegment {
+    uint32_t generation; // bumped on every write, 0 = not written yet (a blank slot reads as zeros)
+    uint32_t flags;
+};
+
+// Segment-level access to a vault. The file is preallocated at creation and segments are only
+// encrypted when something is first written to them, so creating a vault costs O(metadata).
+class Vault {
+public:
+    Vault();
+    ~Vault();
+
+    // progress counts the prefilled segments, a cancelled prefill removes the file again
+    static bool create(const std::string& path, KeySession& session, SFMHeader header, uint64_t capacity, bool prefill,
+                       JobProgress* progress = nullptr);
+    bool open(const std::string& path, KeySession& session); // checks the password on segment 0
+    void close();
+
+    uint64_t capacity() const { return seg.plainSize; }
+    uint32_t segmentSize() const { return seg.segmentSize; }
+    uint64_t segmentCount() const { return seg.segmentCount; }
+    bool isReadOnly() const { return counterNonces; } // a version 3 vault
+    bool isWritten(uint64_t index);
+
+    bool readSegment(uint64_t index, uint8_t* plain);        // segmentSize bytes
+    bool writeSegment(uint64_t index, const uint8_t* plain); // segmentSize bytes
+
+    // byte ranges of the plaintext space, partial segments are read, patched and rewritten.
+    // without a cache they share one scratch segment, callers serialise them (VaultStore holds its own lock).
+    // with one they go through SegmentCache, are safe from several threads and writes land on flush
+    bool read(uint64_t offset, uint8_t* data, size_t len);
+    bool write(uint64_t offset, const uint8_t* data, size_t len);
+    bool flush();
+
+    void enableCache(uint64_t bytes); // call after open, close() writes back and drops it
+    SegmentCache* segmentCache() { return cache.get(); }
+    bool checkKey(KeySession& session); // does this password open the vault that is already open?
+
+private:
+    std::fstream file;
+    std::mutex mutex;
+    SFMHeader header;
+    SegmentHeader seg;
+    std::vector<VaultSegment> table;
+    uint64_t tableOffset;
+    uint64_t dataOffset;
+    CryptoPP::SecByteBlock key;
+    std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> encryptor; // header.algoType, see cipher.h
+    std::unique_ptr<CryptoPP::AuthenticatedSymmetricCipher> decryptor;
+    std::vector<uint8_t> buffer;
+    CryptoPP::SecByteBlock scratch; // plaintext of a partial segment, wiped after every read / write
+    std::unique_ptr<SegmentCache> cache;
+    CryptoPP::AutoSeededRandomPool prng; // per-write nonces
+    bool counterNonces; // version 3 layout: no nonce in the slot, never written to
+
+    bool setKey(const CryptoPP::SecByteBlock& vaultKey);
+    uint64_t slotSize() const { return seg.segmentSize + (counterNonces ? AUTH_TAG_SIZE : VAULT_SLOT_OVERHEAD); }
+    bool writeSegmentLocked(uint64_t index, const uint8_t* plain);
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "wipe.h"
+#include "progress.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+#include <cryptopp/osrng.h>
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+using namespace CryptoPP;
+
+#define WIPE_ALIGNMENT 4096
+
+namespace {
+
+enum PassPattern { ZEROS, ONES, RANDOM };
+
+struct WipePass {
+    const char* name;
+    PassPattern pattern;
+    bool verify;
+};
+
+std::vector<WipePass> passesFor(WipePolicy policy) {
+    switch (policy) {
+        case WipePolicy::RANDOM_1PASS:
+            return { {"random", RANDOM, false} };
+        case WipePolicy::VERIFIED:
+            return { {"random", RANDOM, true} };
+        case WipePolicy::STANDARD_3PASS:
+        default:
+            return { {"zeros", ZEROS, false}, {"ones", ONES, false}, {"random", RANDOM, false} };
+    }
+}
+
+// buffer aligned for O_DIRECT, also keeps the AES-CTR writes on whole cache lines
+class AlignedBuffer {
+public:
+    explicit AlignedBuffer(size_t size) : storage(size + WIPE_ALIGNMENT), length(size) {
+        uintptr_t p = reinterpret_cast<uintptr_t>(storage.data());
+        aligned = reinterpret_cast<uint8_t*>((p + WIPE_ALIGNMENT - 1) & ~static_cast<uintptr_t>(WIPE_ALIGNMENT - 1));
+    }
+    uint8_t* data() { return aligned; }
+    size_t size() const { return length; }
+
+private:
+    std::vector<uint8_t> storage;
+    uint8_t* aligned;
+    size_t length;
+};
+
+// the file as seen by the wipe passes: whole aligned blocks may go through O_DIRECT, the tail never does
+class WipeTarget {
+public:
+    ~WipeTarget() { close(); }
+
+    bool open(const std::string& path, bool direct, uint64_t& size) {
+#ifdef _WIN32
+        (void)direct;
+        file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file.is_open()) return false;
+        file.seekg(0, std::ios::end);
+        size = static_cast<uint64_t>(file.tellg());
+        return true;
+#else
+        fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+        size = static_cast<uint64_t>(st.st_size);
+#ifdef O_DIRECT
+        if (direct) directFd = ::open(path.c_str(), O_RDWR | O_DIRECT); // stays -1 where unsupported (tmpfs)
+#else
+        (void)direct;
+#endif
+        return true;
+#endif
+    }
+
+    bool usingDirect() const { return directFd >= 0; }
+
+    bool writeAt(uint64_t offset, const uint8_t* data, size_t len) {
+#ifdef _WIN32
+        file.seekp(offset);
+        file.write(reinterpret_cast<const char*>(data), len);
+        return file.good();
+#else
+        int target = pick(offset, len);
+        while (len > 0) {
+            ssize_t n = ::pwrite(target, data, len, static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            data += n;
+            offset += n;
+            len -= n;
+        }
+        return true;
+#endif
+    }
+
+    bool readAt(uint64_t offset, uint8_t* data, size_t len) {
+#ifdef _WIN32
+        file.seekg(offset);
+        file.read(reinterpret_cast<char*>(data), len);
+        return file.good();
+#else
+        int target = pick(offset, len);
+        while (len > 0) {
+            ssize_t n = ::pread(target, data, len, static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            data += n;
+            offset += n;
+            len -= n;
+        }
+        return true;
+#endif
+    }
+
+    // after sync: the pages just written are dropped so the read back has to come from the device.
+    // false where that cannot be done, a read back then only proves the data reached memory
+    bool dropCache() {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+        return ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+#else
+        return false;
+#endif
+    }
+
+    bool sync() {
+        StatTimer timer(STAT_SYNC_NS, "sync");
+        statAdd(STAT_SYNC_CALLS, 1);
+#ifdef _WIN32
+        file.flush();
+        return file.good();
+#elif defined(__APPLE__)
+        return ::fsync(fd) == 0;
+#else
+        return ::fdatasync(fd) == 0;
+#endif
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (file.is_open()) file.close();
+#else
+        if (directFd >= 0) ::close(directFd);
+        if (fd >= 0) ::close(fd);
+        directFd = fd = -1;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    std::fstream file;
+#endif
+    int fd = -1;
+    int directFd = -1;
+
+    int pick(uint64_t offset, size_t len) const {
+        bool aligned = (offset % WIPE_ALIGNMENT == 0) && (len % WIPE_ALIGNMENT == 0);
+        return (directFd >= 0 && aligned) ? directFd : fd;
+    }
+};
+
+void fillPattern(PassPattern pattern, CTR_Mode<AES>::Encryption& keystream, uint8_t* data, size_t len) {
+    if (pattern == RANDOM) {
+        std::memset(data, 0, len);
+        keystream.ProcessString(data, len); // zeros xor keystream = keystream
+    } else {
+        std::memset(data, pattern == ONES ? 0xFF : 0x00, len);
+    }
+}
+
+}
+
+WipePolicy parseWipePolicy(const std::string& name, bool& ok) {
+    ok = true;
+    if (name == "quick" || name == "1") return WipePolicy::RANDOM_1PASS;
+    if (name == "3pass" || name == "3") return WipePolicy::STANDARD_3PASS;
+    if (name == "verify") return WipePolicy::VERIFIED;
+    ok = false;
+    return WipePolicy::STANDARD_3PASS;
+}
+
+bool wipeFileContents(const std::string& filePath, const WipeOptions& options,
+                      std::vector<WipePassReport>& report, std::string& error, JobProgress* progress) {
+    report.clear();
+
+    WipeTarget target;
+    uint64_t fileSize = 0;
+    if (!target.open(filePath, options.direct, fileSize)) {
+        error = "File not found or currently in use.";
+        return false;
+    }
+    if (fileSize == 0) return true;
+
+    size_t bufferSize = options.bufferSize - options.bufferSize % WIPE_ALIGNMENT;
+    if (bufferSize < WIPE_ALIGNMENT) bufferSize = WIPE_ALIGNMENT;
+    AlignedBuffer buffer(bufferSize);
+    std::unique_ptr<AlignedBuffer> expected;
+
+    AutoSeededRandomPool prng;
+    std::vector<WipePass> passes = passesFor(options.policy);
+
+    uint64_t work = 0;
+    for (const WipePass& pass : passes) work += pass.verify ? 2 * fileSize : fileSize;
+    if (progress) progress->begin("Wiping", work);
+    bool touched = false;
+    auto stopped = [&]() {
+        if (!progress || !progress->cancelled()) return false;
+        error = touched ? "Wipe cancelled, the file is only partly overwritten." : "Wipe cancelled, the file is untouched.";
+        return true;
+    };
+
+    for (const WipePass& pass : passes) {
+        auto start = std::chrono::steady_clock::now();
+        StatTimer timer(STAT_WIPE_NS, "wipe pass");
+
+        // one random key per pass, the generator is only touched for 48 bytes instead of per block
+        SecByteBlock key(AES::MAX_KEYLENGTH);
+        uint8_t iv[AES::BLOCKSIZE];
+        prng.GenerateBlock(key, key.size());
+        prng.GenerateBlock(iv, sizeof(iv));
+        CTR_Mode<AES>::Encryption keystream;
+        keystream.SetKeyWithIV(key, key.size(), iv, sizeof(iv));
+
+        for (uint64_t offset = 0; offset < fileSize; offset += bufferSize) {
+            if (stopped()) return false;
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(bufferSize, fileSize - offset));
+            fillPattern(pass.pattern, keystream, buffer.data(), chunk);
+            touched = true;
+            if (!target.writeAt(offset, buffer.data(), chunk)) {
+                error = std::string("Write failed during the ") + pass.name + " pass.";
+                return false;
+            }
+            if (progress) progress->advance(chunk);
+        }
+        if (!target.sync()) {
+            error = std::string("Sync failed after the ") + pass.name + " pass.";
+            return false;
+        }
+
+        WipePassReport stats;
+        stats.name = pass.name;
+        stats.bytes = fileSize;
+        statAdd(STAT_WIPE_PASSES, 1);
+        statAdd(STAT_WIPE_BYTES, fileSize);
+
+        if (pass.verify) {
+            // same key and iv again regenerates exactly what should now be on disk
+            bool fromDevice = target.dropCache();
+            if (!expected) expected.reset(new AlignedBuffer(bufferSize));
+            keystream.SetKeyWithIV(key, key.size(), iv, sizeof(iv));
+            for (uint64_t offset = 0; offset < fileSize; offset += bufferSize) {
+                if (stopped()) return false;
+                size_t chunk = static_cast<size_t>(std::min<uint64_t>(bufferSize, fileSize - offset));
+                fillPattern(pass.pattern, keystream, expected->data(), chunk);
+                if (!target.readAt(offset, buffer.data(), chunk) ||
+                    std::memcmp(buffer.data(), expected->data(), chunk) != 0) {
+                    error = "Verification failed at offset " + std::to_string(offset) + ".";
+                    return false;
+                }
+                if (progress) progress->advance(chunk);
+            }
+            stats.readBack = true;
+            stats.verified = fromDevice;
+        }
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report.push_back(stats);
+    }
+
+    target.close();
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef WIPE_H
+#define WIPE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum class WipePolicy : uint8_t {
+    RANDOM_1PASS = 1, // one pass of AES-CTR keystream
+    STANDARD_3PASS = 2, // zeros, ones, random
+    VERIFIED = 3 // random, then read back and compare
+};
+
+struct WipeOptions {
+    WipePolicy policy = WipePolicy::STANDARD_3PASS;
+    bool direct = false; // O_DIRECT where available, bypasses the page cache
+    size_t bufferSize = 4 * 1024 * 1024;
+};
+
+struct WipePassReport {
+    std::string name;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    bool readBack = false; // a verify pass compared what is on the file
+    bool verified = false; // ... and read it from the device, not from the page cache
+
+    double mbPerSecond() const { return (seconds > 0) ? bytes / (1024.0 * 1024.0) / seconds : 0; }
+};
+
+class JobProgress;
+
+WipePolicy parseWipePolicy(const std::string& name, bool& ok); // "quick", "3pass", "verify"
+
+// Overwrites every byte of the file according to the policy, one fdatasync per pass.
+// The file itself is left in place, removing it is up to the caller.
+// progress counts every pass (and the read back), a cancel stops at the next buffer.
+bool wipeFileContents(const std::string& filePath, const WipeOptions& options,
+                      std::vector<WipePassReport>& report, std::string& error, JobProgress* progress = nullptr);
+
+#endif
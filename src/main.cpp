@@ -1,68 +1,292 @@
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <filesystem>
+#include "core/agent.h"
 #include "core/functions.h"
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cout << "Usage: sfm_tool <command> <args...>\n";
-        std::cout << "Commands:\n";
-        std::cout << "  create <vault_name> [size_mb]   Create a new empty vault\n";
-        std::cout << "  open   <vault_name>             Check vault password\n";
-        std::cout << "  enc    <input_file> <out_file>  Encrypt a single file\n";
-        std::cout << "  dec    <sfm_file>   <out_file>  Decrypt a single file\n";
-        std::cout << "  del    <file_path>              Securely wipe & delete a file\n";
-        return 1;
+#include "core/cipher.h"
+#include "core/compress.h"
+#include "core/kdf.h"
+#include "core/parallel.h"
+#include "core/stats.h"
+
+#include <cryptopp/misc.h>
+
+struct CliOptions {
+    std::string range;
+    int threads = 0;
+    bool recursive = false;
+    bool prefill = false;
+    bool yes = false;
+    bool stats = false;     // --stats=json
+    std::string tracePath;  // --trace <file>
+    WipeOptions wipe;
+    uint32_t cipher = ALGO_AUTO;
+    uint32_t codec = CODEC_NONE;
+    double targetMs = 250;
+    uint64_t maxMemMb = 1024;
+    int idleSeconds = AGENT_DEFAULT_IDLE_SECONDS;
+    std::string kdfProfile;
+};
+
+static void printBatchReport(const BatchReport& report) {
+    double mb = report.bytes / (1024.0 * 1024.0);
+    double rate = (report.seconds > 0) ? mb / report.seconds : 0;
+    std::cout << "[Batch] " << report.files << " files, " << report.failed << " failed, "
+              << mb << " MB in " << report.seconds << " s (" << rate << " MB/s)\n";
+    for (const auto& path : report.failures) {
+        std::cout << "  failed: " << path << "\n";
+    }
+}
+
+// numbers from the command line, a bad one is reported like the other argument errors instead of throwing
+static bool parseCount(const std::string& what, const std::string& text, uint64_t min, uint64_t max, uint64_t& value) {
+    try {
+        size_t used = 0;
+        if (!text.empty() && text[0] != '-') value = std::stoull(text, &used); // stoull would wrap "-1"
+        if (used > 0 && used == text.size() && value >= min && value <= max) return true;
+    } catch (const std::exception&) {
     }
+    std::cout << "Invalid " << what << ": '" << text << "', expected a whole number from " << min << " to " << max << ".\n";
+    return false;
+}
 
-    std::string command = argv[1];
-    
-    std::string password;
-    std::cout << "Enter Password: ";
-    std::cin >> password;
+static bool parseCount(const std::string& what, const std::string& text, int min, int max, int& value) {
+    uint64_t wide;
+    if (!parseCount(what, text, static_cast<uint64_t>(min), static_cast<uint64_t>(max), wide)) return false;
+    value = static_cast<int>(wide);
+    return true;
+}
 
-    ContainerManager manager;
-    
-    if (!manager.authenticateOrRegister("pass", password)) {
-        return 1; 
+// options may appear anywhere, everything else is positional
+static bool parseArgs(const std::vector<std::string>& argv, CliOptions& opt, std::vector<std::string>& args) {
+    for (size_t i = 0; i < argv.size(); i++) {
+        const std::string& arg = argv[i];
+        bool hasValue = i + 1 < argv.size();
+        if (arg == "--range" && hasValue) {
+            opt.range = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            if (!parseCount("--threads", argv[++i], 0, 4096, opt.threads)) return false;
+        } else if (arg == "-r") {
+            opt.recursive = true;
+        } else if (arg == "--prefill") {
+            opt.prefill = true;
+        } else if (arg == "--yes") {
+            opt.yes = true;
+        } else if (arg == "--stats=json" || (arg == "--stats" && hasValue && argv[i + 1] == "json")) {
+            if (arg == "--stats") i++;
+            opt.stats = true;
+        } else if (arg == "--trace" && hasValue) {
+            opt.tracePath = argv[++i];
+        } else if (arg == "--wipe" && hasValue) {
+            bool ok;
+            opt.wipe.policy = parseWipePolicy(argv[++i], ok);
+            if (!ok) {
+                std::cout << "Unknown wipe policy, use quick, 3pass or verify.\n";
+                return false;
+            }
+        } else if (arg == "--cipher" && hasValue) {
+            bool ok;
+            opt.cipher = parseAlgo(argv[++i], ok);
+            if (!ok) {
+                std::cout << "Unknown cipher, use aes, chacha or auto.\n";
+                return false;
+            }
+        } else if (arg == "--compress" && hasValue) {
+            bool ok;
+            opt.codec = parseCodec(argv[++i], ok);
+            if (!ok) {
+                std::cout << "Unknown codec, use deflate or none.\n";
+                return false;
+            }
+        } else if (arg == "--target-ms" && hasValue) {
+            uint64_t ms;
+            if (!parseCount("--target-ms", argv[++i], 1, 3600 * 1000, ms)) return false;
+            opt.targetMs = static_cast<double>(ms);
+        } else if (arg == "--max-mem-mb" && hasValue) {
+            if (!parseCount("--max-mem-mb", argv[++i], 1, 1024 * 1024, opt.maxMemMb)) return false;
+        } else if (arg == "--kdf-profile" && hasValue) {
+            opt.kdfProfile = argv[++i];
+        } else if (arg == "--idle-timeout" && hasValue) {
+            if (!parseCount("--idle-timeout", argv[++i], 1, INT_MAX, opt.idleSeconds)) return false;
+        } else if (arg == "--direct") {
+            opt.wipe.direct = true;
+        } else {
+            args.push_back(arg);
+        }
     }
+    return true;
+}
+
+// every option is set, the agent reuses one manager for requests with different options
+static bool configure(ContainerManager& manager, const CliOptions& opt) {
+    manager.setThreadCount(opt.threads > 0 ? opt.threads : defaultThreadCount());
+    manager.setWipeOptions(opt.wipe);
+    manager.setCipher(opt.cipher);
+    manager.setCompression(opt.codec);
+    std::string profile = opt.kdfProfile.empty() ? KDF_DEFAULT_PROFILE : opt.kdfProfile;
+    if (!manager.setKdfProfile(profile)) {
+        std::cout << "No KDF profile named '" << profile << "', run kdf-calibrate --kdf-profile " << profile << " first.\n";
+        return false;
+    }
+    return true;
+}
+
+// commands that only need the unlocked manager and no further input, a running agent serves these
+static bool isAgentCommand(const std::string& command) {
+    static const char* commands[] = {"create", "open", "add", "extract", "ls", "rm", "enc", "dec", "del"};
+    for (const char* c : commands) {
+        if (command == c) return true;
+    }
+    return false;
+}
+
+static int runCommand(ContainerManager& manager, const CliOptions& opt, const std::vector<std::string>& args, const std::string& password) {
+    std::string command = args[0];
+    bool recursive = opt.recursive;
+    bool prefill = opt.prefill;
+    const std::string& range = opt.range;
 
     if (command == "create") {
-        std::string filePath = argv[2];
-        long sizeMb = (argc >= 4) ? std::stol(argv[3]) : 10;
-        long sizeBytes = sizeMb * 1024 * 1024;
+        std::string filePath = args[1];
+        uint64_t sizeMb = 10;
+        if (args.size() >= 3 && !parseCount("vault size (MB)", args[2], 1, LONG_MAX >> 20, sizeMb)) return 1;
+        long sizeBytes = static_cast<long>(sizeMb * 1024 * 1024);
         
-        if (manager.createContainer(filePath, password, sizeBytes)) {
+        if (manager.createContainer(filePath, password, sizeBytes, prefill)) {
             std::cout << "Container created!\n";
         }
     } 
     else if (command == "open") {
-        std::string filePath = argv[2];
+        std::string filePath = args[1];
         manager.openContainer(filePath, password);
     }
+    else if (command == "add") {
+        if (args.size() < 3) {
+            std::cout << "Usage: sfm_tool add <vault> <file> [name]\n";
+            return 1;
+        }
+        std::string name = (args.size() >= 4) ? args[3] : std::filesystem::path(args[2]).filename().string();
+        return manager.addFile(args[1], password, args[2], name) ? 0 : 1;
+    }
+    else if (command == "extract") {
+        if (args.size() < 4) {
+            std::cout << "Usage: sfm_tool extract <vault> <name> <out>\n";
+            return 1;
+        }
+        return manager.extractFile(args[1], password, args[2], args[3]) ? 0 : 1;
+    }
+    else if (command == "ls") {
+        std::vector<VaultFileInfo> files;
+        if (!manager.listFiles(args[1], password, files)) return 1;
+        for (const auto& f : files) {
+            std::cout << "  " << f.size << "\t" << f.name << "\n";
+        }
+        std::cout << files.size() << " file(s)\n";
+    }
+    else if (command == "rm") {
+        if (args.size() < 3) {
+            std::cout << "Usage: sfm_tool rm <vault> <name>\n";
+            return 1;
+        }
+        return manager.removeFile(args[1], password, args[2]) ? 0 : 1;
+    }
+    else if (command == "mount") {
+        if (args.size() < 3) {
+            std::cout << "Usage: sfm_tool mount <vault> <dir>\n";
+            return 1;
+        }
+        return manager.mountVault(args[1], password, args[2]) ? 0 : 1;
+    }
 
+    else if (command == "enc" && recursive) {
+        std::string input = args[1];
+        std::filesystem::path dir(input);
+        if (dir.filename().empty()) dir = dir.parent_path(); // "docs/"
+        std::string name = (args.size() >= 3) ? args[2] : dir.filename().string();
+        BatchReport report = manager.encryptTree(input, name, password);
+        printBatchReport(report);
+        return report.failed == 0 ? 0 : 1;
+    }
+    else if (command == "dec" && recursive) {
+        if (args.size() < 3) {
+            std::cout << "Usage: sfm_tool dec -r <dir> <out_dir>\n";
+            return 1;
+        }
+        BatchReport report = manager.decryptTree(args[1], args[2], password);
+        printBatchReport(report);
+        return report.failed == 0 ? 0 : 1;
+    }
     else if (command == "enc") {
-        if (argc < 4) {
+        if (args.size() < 3) {
             std::cout << "Usage: sfm_tool enc <input> <output>\n";
             return 1;
         }
-        std::string input = argv[2];
-        std::string output = argv[3];
+        std::string input = args[1];
+        std::string output = args[2];
         manager.encryptFile(input, output, password);
     }
     else if (command == "dec") {
-        if (argc < 4) {
-            std::cout << "Usage: sfm_tool dec <input> <output>\n";
+        if (args.size() < 3) {
+            std::cout << "Usage: sfm_tool dec [--range off:len] <input> <output>\n";
             return 1;
         }
-        std::string input = argv[2];
-        std::string output = argv[3];
-        manager.decryptFile(input, output, password);
+        std::string input = args[1];
+        std::string output = args[2];
+        if (!range.empty()) {
+            size_t colon = range.find(':');
+            if (colon == std::string::npos) {
+                std::cout << "Range must look like <offset>:<length>\n";
+                return 1;
+            }
+            uint64_t offset, length;
+            if (!parseCount("range offset", range.substr(0, colon), 0, UINT64_MAX, offset) ||
+                !parseCount("range length", range.substr(colon + 1), 0, UINT64_MAX, length)) {
+                return 1;
+            }
+            manager.decryptRange(input, output, password, offset, length);
+        } else {
+            manager.decryptFile(input, output, password);
+        }
+    }
+    else if (command == "migrate") {
+        std::string legacyPassword;
+        std::cout << "Legacy Password: ";
+        std::cin >> legacyPassword;
+        std::vector<std::string> inputs(args.begin() + 1, args.end());
+        BatchReport report = manager.migrateLegacy(inputs, legacyPassword, password);
+        printBatchReport(report);
+        return report.failed == 0 ? 0 : 1;
+    }
+    else if (command == "passwd") {
+        std::string newPassword;
+        std::cout << "New Password: ";
+        std::cin >> newPassword;
+        // vaults outside ~/.sfm have to be named
+        std::vector<std::string> vaults(args.begin() + 1, args.end());
+        return manager.changePassword("pass", password, newPassword, vaults) ? 0 : 1;
+    }
+    else if (command == "addkey" || command == "rmkey") {
+        if (args.size() < 2) {
+            std::cout << "Usage: sfm_tool " << command << " <file>\n";
+            return 1;
+        }
+        if (command == "rmkey") return manager.removeKeySlot(args[1], password) ? 0 : 1;
+        std::string extra;
+        std::cout << "Additional Password: ";
+        std::cin >> extra;
+        return manager.addKeySlot(args[1], password, extra) ? 0 : 1;
     }
     else if (command == "del") {
-        std::string filePath = argv[2];
-        std::cout << "WARNING: This will permanently destroy data in: " << filePath << "\n";
-        std::cout << "Are you sure? (y/n): ";
-        char confirm;
-        std::cin >> confirm;
+        std::string filePath = args[1];
+        char confirm = 'y';
+        if (!opt.yes) {
+            std::cout << "WARNING: This will permanently destroy data in: " << filePath << "\n";
+            std::cout << "Are you sure? (y/n): ";
+            std::cin >> confirm;
+        }
         if (confirm == 'y' || confirm == 'Y') {
             manager.secureDeleteFile(filePath);
         } else {
@@ -75,3 +299,147 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+
+// the counters cover this one command, the agent serves many
+static int runMeasured(ContainerManager& manager, const CliOptions& opt, const std::vector<std::string>& args, const std::string& password) {
+    statsReset();
+    if (!opt.tracePath.empty() && !startTrace(opt.tracePath)) {
+        std::cerr << "[Error] Cannot write the trace to " << opt.tracePath << "\n";
+        return 1;
+    }
+    int status = runCommand(manager, opt, args, password);
+    if (!opt.tracePath.empty() && !stopTrace()) std::cerr << "[Error] Could not write the trace.\n";
+    if (opt.stats) std::cerr << statsJson() << "\n";
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> raw(argv + 1, argv + argc);
+    std::vector<std::string> args;
+    CliOptions opt;
+    if (!parseArgs(raw, opt, args)) return 1;
+
+    // needs no password, only measures this machine
+    if (!args.empty() && args[0] == "kdf-calibrate") {
+        std::string name = opt.kdfProfile.empty() ? KDF_DEFAULT_PROFILE : opt.kdfProfile;
+        std::cout << "[Core] Calibrating scrypt for " << opt.targetMs << " ms...\n";
+        KdfProfile profile = calibrateKdf(name, opt.targetMs, opt.maxMemMb * 1024 * 1024);
+        std::cout << "[Core] N=" << profile.cost << " r=" << profile.blockSize << " p=" << profile.parallelism
+                  << ": " << profile.millis << " ms, " << (128.0 * profile.cost * profile.blockSize / (1024 * 1024)) << " MB\n";
+        if (!saveKdfProfile(profile)) {
+            std::cerr << "[Error] Could not save the profile.\n";
+            return 1;
+        }
+        std::cout << "[Success] Saved as profile '" << name << "'.\n";
+        return 0;
+    }
+
+    if (args.empty() || (args.size() < 2 && args[0] != "passwd" && args[0] != "agent")) {
+        std::cout << "Usage: sfm_tool <command> <args...>\n";
+        std::cout << "Commands:\n";
+        std::cout << "  create <vault_name> [size_mb]   Create a new empty vault\n";
+        std::cout << "         --prefill                Encrypt the whole vault up front instead of on first write\n";
+        std::cout << "  open   <vault_name>             Check vault password\n";
+        std::cout << "  add    <vault> <file> [name]    Store a file inside a vault\n";
+        std::cout << "  extract <vault> <name> <out>    Copy a file out of a vault\n";
+        std::cout << "  ls     <vault>                  List the files in a vault\n";
+        std::cout << "  rm     <vault> <name>           Remove a file from a vault\n";
+        std::cout << "  mount  <vault> <dir>            Serve a vault's files under dir until unmounted (FUSE builds)\n";
+        std::cout << "  enc    <input_file> <out_file>  Encrypt a single file\n";
+        std::cout << "  dec    <sfm_file>   <out_file>  Decrypt a single file\n";
+        std::cout << "         --range <off>:<len>      Only decrypt that byte range, keep the .sfm\n";
+        std::cout << "  enc -r <dir> [out_name]         Encrypt a whole directory tree\n";
+        std::cout << "  dec -r <dir> <out_dir>          Decrypt every .sfm under a directory\n";
+        std::cout << "  del    <file_path>              Securely wipe & delete a file\n";
+        std::cout << "  migrate <file|dir>...           Re-encrypt files of the old aes.cpp prototype into ~/.sfm, keeps them\n";
+        std::cout << "  passwd [vault...]               Change the password, rewraps the key of every file in ~/.sfm\n";
+        std::cout << "  addkey <file>                   Let a second password open a file or vault\n";
+        std::cout << "  rmkey  <file>                   Remove the key slot this password opens\n";
+        std::cout << "  agent                           Unlock once and serve create/add/extract/ls/rm/enc/dec/del\n";
+        std::cout << "                                  from other sfm_tool calls over a Unix socket\n";
+        std::cout << "         --idle-timeout <s>       Exit and forget the keys after s idle seconds (default: 900)\n";
+        std::cout << "  kdf-calibrate                   Measure scrypt and save the cost used for new files\n";
+        std::cout << "         --target-ms <ms>         Unlock time to aim for (default: 250)\n";
+        std::cout << "         --max-mem-mb <mb>        Memory limit for scrypt (default: 1024)\n";
+        std::cout << "Options:\n";
+        std::cout << "  --threads <n>                   Worker threads for enc/dec (default: all cores)\n";
+        std::cout << "  --wipe quick|3pass|verify       Wipe policy for del and the wipe after enc/dec (default: 3pass)\n";
+        std::cout << "  --cipher aes|chacha|auto        Cipher for new files and vaults (default: auto, fastest on this CPU)\n";
+        std::cout << "  --compress deflate|none         Compress new files before encrypting (default: none)\n";
+        std::cout << "  --kdf-profile <name>            Scrypt profile for new files, saved by kdf-calibrate (default: default)\n";
+        std::cout << "  --direct                        Wipe with O_DIRECT, bypassing the page cache\n";
+        std::cout << "  --yes                           Do not ask before del\n";
+        std::cout << "  --stats=json                    Print where the time went (kdf, read, crypto, write, sync) to stderr\n";
+        std::cout << "  --trace <file>                  Write a Chrome trace (chrome://tracing, Perfetto) of the command\n";
+        return 1;
+    }
+
+    std::string command = args[0];
+
+    // a running agent already holds the keys: no prompt and no scrypt
+    if (isAgentCommand(command)) {
+        if (command == "del" && !opt.yes) {
+            std::cout << "WARNING: This will permanently destroy data in: " << args[1] << "\n";
+            std::cout << "Are you sure? (y/n): ";
+            char confirm;
+            std::cin >> confirm;
+            if (confirm != 'y' && confirm != 'Y') {
+                std::cout << "Operation cancelled.\n";
+                return 0;
+            }
+            opt.yes = true;
+            raw.push_back("--yes");
+        }
+        std::string output;
+        int status;
+        AgentCall call = callAgent(agentSocketPath(), raw, output, status);
+        if (call == AgentCall::DONE) {
+            std::cout << output;
+            return status;
+        }
+        if (call == AgentCall::LOST) {
+            // running it here as well could encrypt, wipe or delete twice
+            std::cerr << "[Error] The agent stopped answering, the command may or may not have run. Check before retrying.\n";
+            return 1;
+        }
+    }
+    
+    std::string password;
+    std::cout << "Enter Password: ";
+    std::cin >> password;
+
+    ContainerManager manager;
+    if (!configure(manager, opt)) return 1;
+    
+    if (!manager.authenticateOrRegister("pass", password)) {
+        return 1; 
+    }
+    manager.unlockSession(password);
+
+    if (command == "agent") {
+        // the session holds the key in locked memory, the long-lived agent keeps no plain copy around
+        CryptoPP::SecureWipeBuffer(&password[0], password.size());
+        password.clear();
+        AgentHandler handler = [&](const std::vector<std::string>& request) {
+            CliOptions requestOpt;
+            std::vector<std::string> requestArgs;
+            if (!parseArgs(request, requestOpt, requestArgs)) return 1;
+            if (requestArgs.empty() || !isAgentCommand(requestArgs[0])) {
+                std::cout << "The agent does not run this command.\n";
+                return 1;
+            }
+            if (requestArgs.size() < 2) {
+                std::cout << "Usage: sfm_tool " << requestArgs[0] << " <args...>\n";
+                return 1;
+            }
+            if (!configure(manager, requestOpt)) return 1;
+            return runMeasured(manager, requestOpt, requestArgs, "");
+        };
+        manager.warmSession();
+        bool ok = runAgent(agentSocketPath(), opt.idleSeconds, handler);
+        manager.lockSession();
+        return ok ? 0 : 1;
+    }
+
+    return runMeasured(manager, opt, args, password);
+}
@@ -3,7 +3,14 @@
 #include <vector>
 #include <filesystem>
 #include <algorithm>
+#include <functional>
 #include "core/functions.h"
+#include "core/comment_cache.h"
+#include "core/dir_cache.h"
+#include "core/progress.h"
+#include "core/stats.h"
+
+#include <cryptopp/misc.h>
 
 namespace fs = std::filesystem;
 
@@ -17,7 +24,15 @@ std::string get_input_str(int y, int x, const std::string& prompt, bool mask = f
     getnstr(buf, 255);
     
     noecho();
-    return std::string(buf);
+    std::string input(buf);
+    if (mask) CryptoPP::SecureWipeBuffer(buf, sizeof(buf));
+    return input;
+}
+
+// passwords are only held until the session has them
+void wipe_str(std::string& s) {
+    if (!s.empty()) CryptoPP::SecureWipeBuffer(&s[0], s.size());
+    s.clear();
 }
 
 void update_status(const std::string& msg, bool is_error = false) {
@@ -34,7 +49,91 @@ void update_status(const std::string& msg, bool is_error = false) {
     doupdate();
 }
 
-std::string file_browser(const std::string& start_dir, ContainerManager* manager = nullptr) {
+// where the last action spent its time, above the status bar
+void show_stats() {
+    move(LINES - 3, 0);
+    clrtoeol();
+    attron(COLOR_PAIR(1));
+    mvprintw(LINES - 3, 2, "%s", statsSummary().c_str());
+    attroff(COLOR_PAIR(1));
+    box(stdscr, 0, 0);
+    wnoutrefresh(stdscr);
+    doupdate();
+}
+
+std::string format_seconds(double seconds) {
+    if (seconds < 0) return "--:--";
+    long s = (long)(seconds + 0.5);
+    char buf[32];
+    if (s >= 3600) snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+    else snprintf(buf, sizeof(buf), "%02ld:%02ld", s / 60, s % 60);
+    return buf;
+}
+
+// stage, bar, bytes, throughput and ETA on rows y and y + 1
+void draw_progress(const JobProgress& progress, int y) {
+    JobProgress::Snapshot s = progress.snapshot();
+    const double mb = 1024.0 * 1024.0;
+
+    move(y, 0);
+    clrtoeol();
+    mvprintw(y, 2, "%s", (*s.stage) ? s.stage : "Deriving key...");
+
+    int width = COLS - 14;
+    if (width < 10) width = 10;
+    int filled = (int)(s.fraction() * width);
+    move(y + 1, 0);
+    clrtoeol();
+    mvaddch(y + 1, 2, '[');
+    attron(COLOR_PAIR(1));
+    for (int i = 0; i < width; i++) addch(i < filled ? '#' : '-');
+    attroff(COLOR_PAIR(1));
+    printw("] %3d%%", (int)(s.fraction() * 100));
+
+    move(y + 2, 0);
+    clrtoeol();
+    if (s.total > 0) {
+        mvprintw(y + 2, 2, "%.1f / %.1f MB  %.1f MB/s  ETA %s", s.done / mb, s.total / mb,
+                 s.bytesPerSecond() / mb, format_seconds(s.etaSeconds()).c_str());
+    }
+    box(stdscr, 0, 0);
+}
+
+// Runs job on a worker thread, the screen keeps a live progress bar and stats line meanwhile.
+// 'c' or ESC cancels, the core then removes whatever partial output the job left.
+// status gets the last line the job printed, output never reaches the terminal directly.
+bool run_job(JobProgress& progress, int y, const std::function<bool()>& job, std::string& status) {
+    progress.reset();
+    BackgroundJob worker;
+    worker.start(job);
+
+    mvprintw(LINES - 2, 2, "Press 'c' to cancel.");
+    timeout(100); // redraw ten times a second
+    while (!worker.finished()) {
+        draw_progress(progress, y);
+        show_stats();
+        int c = getch();
+        if ((c == 'c' || c == 27) && !progress.cancelled()) {
+            progress.cancel();
+            update_status("Cancelling...");
+        }
+    }
+    timeout(-1);
+
+    bool ok = worker.wait();
+    draw_progress(progress, y);
+    move(LINES - 2, 0);
+    clrtoeol();
+
+    std::string out = worker.output();
+    while (!out.empty() && out.back() == '\n') out.pop_back();
+    status = out.substr(out.find_last_of('\n') + 1); // npos + 1 is the whole string
+    return ok;
+}
+
+// comments: shows the header comment of each file, looked up through the persistent cache
+std::string file_browser(const std::string& start_dir, CommentCache* comments = nullptr) {
+    static DirectoryCache dir_cache;
     std::string current_dir = start_dir;
     int highlight = 0;
     int offset = 0;
@@ -46,33 +145,9 @@ std::string file_browser(const std::string& start_dir, ContainerManager* manager
         mvprintw(1, 2, " [ Dir: %s ] ", current_dir.c_str());
         attroff(A_BOLD);
 
-        std::vector<fs::directory_entry> entries;
-        try {
-            for (const auto& entry : fs::directory_iterator(current_dir)) {
-                entries.push_back(entry);
-            }
-        } catch (...) {}
-
-        std::sort(entries.begin(), entries.end(), [](const fs::directory_entry& a, const fs::directory_entry& b) {
-            if (a.is_directory() && !b.is_directory()) return true;
-            if (!a.is_directory() && b.is_directory()) return false;
-            return a.path().filename().string() < b.path().filename().string();
-        });
-
-        std::vector<std::string> display_list;
-        for (const auto& e : entries) {
-            std::string name = e.path().filename().string();
-            if (e.is_directory()) {
-                name = "[ ] " + name;
-            } 
-            else if (manager != nullptr) {
-                std::string cmt = manager->getFileComment(e.path().string());
-                if (!cmt.empty()) {
-                    name += "  // " + cmt;
-                }
-            }
-            display_list.push_back(name);
-        }
+        // listings outlive the loop and are patched from inotify events, a keypress only redraws the window
+        const std::vector<ListingEntry>& entries = dir_cache.list(current_dir);
+        if (highlight >= (int)entries.size()) highlight = entries.empty() ? 0 : entries.size() - 1;
 
         int max_lines = LINES - 4;
         if (highlight < offset) {
@@ -82,13 +157,24 @@ std::string file_browser(const std::string& start_dir, ContainerManager* manager
             offset = highlight - max_lines + 1;
         }
 
-        for (int i = 0; i < max_lines && (i + offset) < display_list.size(); i++) {
+        for (int i = 0; i < max_lines && (i + offset) < entries.size(); i++) {
              int idx = i + offset;
-             bool is_dir = entries[idx].is_directory();
+             const ListingEntry& e = entries[idx];
+             std::string name = e.name;
+             if (e.isDir) {
+                 name = "[ ] " + name;
+             }
+             else if (comments != nullptr) {
+                 // the file itself is only opened when size or mtime changed
+                 const std::string& cmt = comments->comment(e.path, e.size, e.mtime);
+                 if (!cmt.empty()) {
+                     name += "  // " + cmt;
+                 }
+             }
              if (idx == highlight) attron(A_REVERSE);
-             if (is_dir) attron(COLOR_PAIR(3));
-             mvprintw(i + 3, 4, " %s ", display_list[idx].c_str());
-             if (is_dir) attroff(COLOR_PAIR(3));
+             if (e.isDir) attron(COLOR_PAIR(3));
+             mvprintw(i + 3, 4, " %s ", name.c_str());
+             if (e.isDir) attroff(COLOR_PAIR(3));
              if (idx == highlight) attroff(A_REVERSE);
         }
         mvprintw(LINES - 2, 2, " Use j/k to navigate, ENTER to select, 'q' to cancel.");
@@ -99,22 +185,24 @@ std::string file_browser(const std::string& start_dir, ContainerManager* manager
         if (c == 'k' || c == KEY_UP) {
            if (highlight > 0) highlight--;
         }else if (c == 'j' || c == KEY_DOWN) {
-           if (highlight < display_list.size() - 1) highlight++;
+           if (highlight + 1 < (int)entries.size()) highlight++;
         }else if (c == 'h' || c == KEY_LEFT) {
            auto parent = fs::path(current_dir).parent_path();
            if (parent != current_dir)
               current_dir = parent.string();
               highlight = 0;
-        }else if (c == 'l' || c == KEY_RIGHT || c == 10) {
-              auto selected = entries[highlight];
-              if (selected.is_directory()) {
-              current_dir = selected.path().string();
+        }else if ((c == 'l' || c == KEY_RIGHT || c == 10) && !entries.empty()) {
+              ListingEntry selected = entries[highlight];
+              if (selected.isDir) {
+              current_dir = selected.path;
               highlight = 0;
         }else {
-              return selected.path().string();
+              if (comments) comments->save();
+              return selected.path;
         }
      highlight = 0;
     }else if (c == 'q') {
+    if (comments) comments->save();
     return "";
     }
 }
@@ -133,6 +221,10 @@ int main() {
     init_pair(3, COLOR_BLUE, COLOR_BLACK);
 
     ContainerManager manager;
+    CommentCache comments(manager);
+    JobProgress progress;
+    manager.setProgress(&progress);
+    std::string job_status;
     
     std::vector<std::string> menu = {
         "Create New Vault",
@@ -144,6 +236,7 @@ int main() {
         "Exit"
     };
 
+    const std::string pass; // empty: the manager uses the unlocked session, no copy of the password is kept
     int highlight = 1;
     while(true) {
         erase();
@@ -178,31 +271,40 @@ int main() {
             box(stdscr, 0, 0);
             curs_set(1);
 
-            std::string pass;
-            
-            if (!manager.isPasswordSet("pass")) {
-                mvprintw(1, 2, "First time setup. Please create a master password.");
-                pass = get_input_str(3, 2, "Enter Password: ", true);
-                std::string pass2 = get_input_str(4, 2, "Confirm Password: ", true);
-                
-                if (pass != pass2 || pass.empty()) {
-                    update_status("Passwords do not match or empty!", true);
-                    curs_set(0); getch(); continue;
-                }
-                manager.setPassword("pass", pass);
-                update_status("Password registered successfully.");
-            } else {
-                pass = get_input_str(2, 2, "Password: ", true);
-                if (!manager.authenticate("pass", pass)) {
-                    update_status("Invalid Password! Access Denied.", true);
-                    curs_set(0); getch(); continue;
+            // the password is asked once, the unlocked session keeps the derived keys for every later action
+            if (!manager.isSessionUnlocked()) {
+                std::string entered;
+                if (!manager.isPasswordSet("pass")) {
+                    mvprintw(1, 2, "First time setup. Please create a master password.");
+                    entered = get_input_str(3, 2, "Enter Password: ", true);
+                    std::string pass2 = get_input_str(4, 2, "Confirm Password: ", true);
+                    bool match = entered == pass2 && !entered.empty();
+                    wipe_str(pass2);
+                    
+                    if (!match) {
+                        wipe_str(entered);
+                        update_status("Passwords do not match or empty!", true);
+                        curs_set(0); getch(); continue;
+                    }
+                    manager.setPassword("pass", entered);
+                    update_status("Password registered successfully.");
+                } else {
+                    entered = get_input_str(2, 2, "Password: ", true);
+                    if (!manager.authenticate("pass", entered)) {
+                        wipe_str(entered);
+                        update_status("Invalid Password! Access Denied.", true);
+                        curs_set(0); getch(); continue;
+                    }
+                    update_status("Authenticated.");
                 }
-                update_status("Authenticated.");
+                manager.unlockSession(entered);
+                wipe_str(entered);
             }
 
             refresh();
             clear();
             box(stdscr, 0, 0);
+            statsReset();
 
             if (highlight == 1) {
                 update_status("Opening system dialog to create vault...");
@@ -211,10 +313,11 @@ int main() {
                 refresh();
                 
                 if (!path.empty()) {
-                    if (manager.createContainer(path, pass, 10 * 1024 * 1024))
+                    mvprintw(2, 2, "Creating: %s", path.c_str());
+                    if (run_job(progress, 4, [&]() { return manager.createContainer(path, pass, 10 * 1024 * 1024); }, job_status))
                         update_status("Vault Created at: " + path);
                     else
-                        update_status("Failed to create vault.", true);
+                        update_status(progress.cancelled() ? "Creation cancelled." : "Failed to create vault: " + job_status, true);
                 } else {
                     update_status("Creation cancelled.");
                 }
@@ -244,49 +347,57 @@ int main() {
                     std::string out = fs::path(in).filename().string();
                     mvprintw(2, 2, "Encrypting: %s", out.c_str());
                     std::string comment = get_input_str(4, 2, "Comment (optional, Enter to skip): ");
-                    mvprintw(6, 2, "Processing...");
-                    refresh();
-                    
-                    if (manager.encryptFile(in, out, pass, comment))
-                        update_status("Encrypted successfully.");
+                    curs_set(0);
+
+                    // the original is wiped once the copy is sealed, a cancel there leaves both
+                    if (!run_job(progress, 6, [&]() { return manager.encryptFile(in, out, pass, comment); }, job_status))
+                        update_status(progress.cancelled() ? "Encryption cancelled, original kept." : "Encryption failed: " + job_status, true);
+                    else if (progress.cancelled())
+                        update_status("Encrypted, but the wipe of the original was cancelled: " + job_status, true);
                     else
-                        update_status("Encryption failed.", true);
+                        update_status("Encrypted successfully.");
                 }
             }
             else if (highlight == 4) { // Decrypt File
                 erase();
-                std::string in = file_browser(getSFMDirectory(), &manager);
+                std::string in = file_browser(getSFMDirectory(), &comments);
                 if (!in.empty()) {
                     erase(); box(stdscr, 0, 0);
                     std::string out = fs::current_path().string() + "/" + fs::path(in).filename().string();
                     mvprintw(2, 2, "Decrypting to: %s", out.c_str());
-                    refresh();
+                    curs_set(0);
 
-                    if (manager.decryptFile(in, out, pass))
-                        update_status("Decrypted successfully.");
+                    comments.forget(in); // decryptFile wipes the .sfm
+                    if (!run_job(progress, 4, [&]() { return manager.decryptFile(in, out, pass); }, job_status))
+                        update_status(progress.cancelled() ? "Decryption cancelled, partial output removed." : "Decryption failed: " + job_status, true);
+                    else if (progress.cancelled())
+                        update_status("Decrypted, but the wipe of the .sfm was cancelled: " + job_status, true);
                     else
-                        update_status("Decryption failed.", true);
+                        update_status("Decrypted successfully.");
                 }
             }
             else if (highlight == 5) { // Secure Wipe
                 std::string path = get_input_str(4, 2, "File to Wipe: ");
                 mvprintw(6, 2, "Confirm Wipe? (y/n): ");
                 if (getch() == 'y') {
-                    if (manager.secureDeleteFile(path))
+                    curs_set(0);
+                    if (run_job(progress, 8, [&]() { return manager.secureDeleteFile(path); }, job_status))
                         update_status("Wiped successfully.");
                     else
-                        update_status("Wipe failed.", true);
+                        update_status((progress.cancelled() ? "Wipe cancelled: " : "Wipe failed: ") + job_status, true);
                 }
             }
             else if (highlight == 6) {
                 erase(); box(stdscr, 0, 0);
                 mvprintw(1, 2, "--- Change Password ---");
                 
-                std::string newPass = get_input_str(3, 2, "Enter New Password: ", true);
-                std::string newPass2 = get_input_str(4, 2, "Confirm New Password: ", true);
+                std::string oldPass = get_input_str(3, 2, "Current Password: ", true);
+                std::string newPass = get_input_str(4, 2, "Enter New Password: ", true);
+                std::string newPass2 = get_input_str(5, 2, "Confirm New Password: ", true);
                 
                 if (newPass == newPass2 && !newPass.empty()) {
-                    if (manager.changePassword("pass", pass, newPass)) {
+                    if (manager.changePassword("pass", oldPass, newPass)) {
+                        manager.unlockSession(newPass);
                         update_status("Password changed successfully.");
                     } else {
                         update_status("Failed to change password.", true);
@@ -294,9 +405,13 @@ int main() {
                 } else {
                     update_status("New passwords do not match or empty!", true);
                 }
+                wipe_str(oldPass);
+                wipe_str(newPass);
+                wipe_str(newPass2);
             }
 
             curs_set(0);
+            show_stats();
             mvprintw(LINES - 2, 2, "Done. Press any key...");
             getch();
             clear();
@@ -0,0 +1,299 @@
+// Benchmarks for the core operations, one result per line so runs can be diffed across releases.
+//   sfm_bench [--csv] [--max-mb N] [--reps N] [--dir path]
+// Every file (including ~/.sfm, HOME is pointed at the bench directory) lives under --dir.
+// A measurement whose operation failed is reported with ok false and the exit status is 1,
+// so a regression that makes things fail does not pass for a fast run. Errors go to stderr.
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cryptopp/osrng.h>
+
+#include "../src/core/functions.h"
+#include "../src/core/segments.h"
+#include "../src/core/session.h"
+
+namespace fs = std::filesystem;
+
+#define BENCH_PASSWORD "sfm-bench-password"
+#define MB (1024.0 * 1024.0)
+
+struct Result {
+    std::string bench;
+    std::string variant;
+    uint64_t bytes;
+    uint64_t items;
+    double seconds;
+    bool ok;
+};
+
+static bool csv = false;
+static bool failed = false;
+static std::ostream* out = nullptr; // the real stdout, std::cout is muted while the core runs
+
+static void report(const Result& r) {
+    if (!r.ok) {
+        failed = true;
+        std::cerr << "[Bench] " << r.bench << " " << r.variant << " failed\n";
+    }
+    double rate = (r.seconds > 0) ? r.bytes / MB / r.seconds : 0;
+    double itemRate = (r.seconds > 0) ? r.items / r.seconds : 0;
+    if (csv) {
+        *out << r.bench << "," << r.variant << "," << r.bytes << "," << r.items << ","
+             << r.seconds << "," << rate << "," << itemRate << "," << (r.ok ? 1 : 0) << "\n";
+    } else {
+        *out << "{\"bench\":\"" << r.bench << "\",\"variant\":\"" << r.variant << "\",\"bytes\":" << r.bytes
+             << ",\"items\":" << r.items << ",\"seconds\":" << r.seconds << ",\"mb_per_s\":" << rate
+             << ",\"items_per_s\":" << itemRate << ",\"ok\":" << (r.ok ? "true" : "false") << "}\n";
+    }
+    out->flush();
+}
+
+// ok is what fn returned, whether the timed operation worked
+static double timeIt(const std::function<bool()>& fn, bool& ok) {
+    auto start = std::chrono::steady_clock::now();
+    ok = fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool writeRandomFile(const std::string& path, uint64_t size) {
+    CryptoPP::AutoSeededRandomPool prng;
+    std::vector<uint8_t> block(4 * 1024 * 1024);
+    prng.GenerateBlock(block.data(), block.size());
+    std::ofstream file(path, std::ios::binary);
+    while (size > 0) {
+        size_t n = (size < block.size()) ? size : block.size();
+        file.write(reinterpret_cast<const char*>(block.data()), n);
+        size -= n;
+    }
+    return file.good();
+}
+
+static std::string sizeName(uint64_t size) {
+    if (size >= 1024ULL * 1024 * 1024) return std::to_string(size >> 30) + "G";
+    if (size >= 1024 * 1024) return std::to_string(size >> 20) + "M";
+    return std::to_string(size >> 10) + "K";
+}
+
+// scrypt at the cost parameters new files are written with, each rep on a cold session
+static void benchKdf(const std::string& sfmFile, int reps) {
+    SFMHeader header;
+    SegmentHeader seg;
+    std::ifstream file(sfmFile, std::ios::binary);
+    file.read(reinterpret_cast<char*>(&header), sizeof(SFMHeader));
+    if (!file || !readSegmentHeader(file, seg)) {
+        report({"kdf_scrypt", "header", 0, 0, 0, false});
+        return;
+    }
+
+    for (int i = 0; i < reps; i++) {
+        KeySession session;
+        session.setPassword(BENCH_PASSWORD);
+        bool ok;
+        double s = timeIt([&]() { return session.masterKey(header, seg.kdfParallelism).size() > 0; }, ok);
+        std::ostringstream variant;
+        variant << "N=" << header.kdfMemoryCost << "/r=" << header.kdfIterations << "/p=" << seg.kdfParallelism;
+        report({"kdf_scrypt", variant.str(), 0, 1, s, ok});
+    }
+}
+
+// 4K, 64K, 1M, 16M, 256M, 4G up to --max-mb.
+// encryptFile includes the wipe of its input, it runs with the quick policy here (see wipe_* for its cost)
+static void benchCrypto(ContainerManager& manager, const std::string& dir, uint64_t maxBytes, int reps) {
+    for (uint64_t size = 4096; size <= maxBytes; size *= 16) {
+        std::string plain = dir + "/plain.bin";
+        std::string name = "bench_" + sizeName(size) + ".sfm";
+        std::string sealed = getSFMDirectory() + "/" + name;
+        std::string restored = dir + "/restored.bin";
+
+        for (int i = 0; i < reps; i++) {
+            bool ok = writeRandomFile(plain, size);
+            double enc = timeIt([&]() { return ok && manager.encryptFile(plain, name, BENCH_PASSWORD); }, ok);
+            report({"encrypt", sizeName(size), size, 1, enc, ok});
+
+            // decryptRange over the whole file is decryptFile without the wipe of the .sfm
+            double dec = timeIt([&]() {
+                return ok && manager.decryptRange(sealed, restored, BENCH_PASSWORD, 0, UINT64_MAX) && fs::file_size(restored) == size;
+            }, ok);
+            report({"decrypt", sizeName(size), size, 1, dec, ok});
+
+            fs::remove(sealed);
+            fs::remove(restored);
+        }
+        fs::remove(plain);
+    }
+}
+
+static void benchWipe(ContainerManager& manager, const std::string& dir, uint64_t bytes, int reps) {
+    const char* policies[] = {"quick", "3pass", "verify"};
+    for (const char* name : policies) {
+        bool known;
+        WipeOptions options;
+        options.policy = parseWipePolicy(name, known);
+        manager.setWipeOptions(options);
+        for (int i = 0; i < reps; i++) {
+            std::string target = dir + "/wipe.bin";
+            bool ok = writeRandomFile(target, bytes);
+            double s = timeIt([&]() { return ok && manager.secureDeleteFile(target) && !fs::exists(target); }, ok);
+            report({"wipe", name, bytes, 1, s, ok});
+        }
+    }
+    WipeOptions quick;
+    quick.policy = WipePolicy::RANDOM_1PASS;
+    manager.setWipeOptions(quick);
+}
+
+// one line per vault, time per GB is seconds / (bytes / 2^30)
+static void benchCreate(ContainerManager& manager, const std::string& dir, uint64_t bytes, int reps) {
+    bool modes[] = {false, true};
+    for (bool prefill : modes) {
+        for (int i = 0; i < reps; i++) {
+            std::string vault = dir + "/vault.sfm";
+            bool ok;
+            double s = timeIt([&]() { return manager.createContainer(vault, BENCH_PASSWORD, static_cast<long>(bytes), prefill); }, ok);
+            report({"create_vault", prefill ? "prefill" : "lazy", bytes, 1, s, ok});
+            fs::remove(vault);
+        }
+    }
+}
+
+// 4 KB reads at random offsets through readAt, the second pass of each rep is served by the segment cache.
+// bytes is at least 1 MB (main checks --max-mb)
+static void benchRandomReads(ContainerManager& manager, const std::string& dir, uint64_t bytes, int reads, int reps) {
+    std::string vault = dir + "/random.sfm";
+    if (!manager.createContainer(vault, BENCH_PASSWORD, static_cast<long>(bytes), true)) {
+        report({"vault_random_read", "create", 0, 0, 0, false});
+        return;
+    }
+
+    std::vector<uint64_t> offsets(reads);
+    CryptoPP::AutoSeededRandomPool prng;
+    for (auto& offset : offsets) offset = prng.GenerateWord32() % (bytes - 4096);
+
+    std::vector<uint8_t> data;
+    for (int i = 0; i < reps; i++) {
+        bool closed = manager.closeVault(vault);
+        const char* passes[] = {"cold", "warm"};
+        for (const char* pass : passes) {
+            bool ok;
+            double s = timeIt([&]() {
+                for (uint64_t offset : offsets) {
+                    if (!manager.readAt(vault, BENCH_PASSWORD, offset, 4096, data) || data.size() != 4096) return false;
+                }
+                return closed;
+            }, ok);
+            report({"vault_random_read", pass, reads * 4096ULL, static_cast<uint64_t>(reads), s, ok});
+        }
+    }
+    if (!manager.closeVault(vault)) report({"vault_random_read", "close", 0, 0, 0, false});
+    fs::remove(vault);
+}
+
+static void benchComments(ContainerManager& manager, const std::string& dir, int files, int reps) {
+    std::string scanDir = dir + "/bench_comments";
+    fs::create_directories(scanDir);
+
+    std::string plain = dir + "/comment.bin";
+    std::string sealed = getSFMDirectory() + "/comment.sfm";
+    if (!writeRandomFile(plain, 4096) || !manager.encryptFile(plain, "comment.sfm", BENCH_PASSWORD, "benchmark comment")) {
+        report({"comment_scan", std::to_string(files) + "_files", 0, 0, 0, false});
+        fs::remove_all(scanDir);
+        return;
+    }
+    for (int i = 0; i < files; i++) {
+        fs::copy_file(sealed, scanDir + "/" + std::to_string(i) + ".sfm", fs::copy_options::overwrite_existing);
+    }
+    fs::remove(sealed);
+
+    for (int i = 0; i < reps; i++) {
+        uint64_t found = 0;
+        bool ok;
+        double s = timeIt([&]() {
+            for (const auto& entry : fs::directory_iterator(scanDir)) {
+                if (!manager.getFileComment(entry.path().string()).empty()) found++;
+            }
+            return found == static_cast<uint64_t>(files); // every copy carries the comment
+        }, ok);
+        report({"comment_scan", std::to_string(files) + "_files", 0, found, s, ok});
+    }
+    fs::remove_all(scanDir);
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t maxMb = 4096;
+    int reps = 3;
+    std::string dir = "sfm_bench";
+    bool usage = false;
+    for (int i = 1; i < argc && !usage; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg == "--csv") csv = true;
+            else if (arg == "--max-mb" && i + 1 < argc) maxMb = std::stoull(argv[++i]);
+            else if (arg == "--reps" && i + 1 < argc) reps = std::stoi(argv[++i]);
+            else if (arg == "--dir" && i + 1 < argc) dir = argv[++i];
+            else usage = true;
+        } catch (const std::exception&) {
+            usage = true; // not a number
+        }
+    }
+    // the random read bench needs a vault larger than one read, 1 TB keeps the byte counts in range
+    if (usage || maxMb < 1 || maxMb > 1024 * 1024 || reps < 1) {
+        std::cerr << "Usage: sfm_bench [--csv] [--max-mb N] [--reps N] [--dir path]\n"
+                  << "  --max-mb 1 to 1048576, --reps at least 1\n";
+        return 1;
+    }
+
+    fs::create_directories(dir);
+    dir = fs::absolute(dir).string();
+    // keeps the bench out of the real ~/.sfm
+#ifdef _WIN32
+    _putenv_s("USERPROFILE", dir.c_str());
+#else
+    setenv("HOME", dir.c_str(), 1);
+#endif
+
+    // the core's progress lines would mix with the results, its errors stay on stderr
+    std::ostream realOut(std::cout.rdbuf());
+    out = &realOut;
+    std::ofstream devNull;
+    std::cout.rdbuf(devNull.rdbuf()); // unopened: everything written to it is dropped
+
+    if (csv) *out << "bench,variant,bytes,items,seconds,mb_per_s,items_per_s,ok\n";
+
+    uint64_t maxBytes = maxMb * 1024 * 1024;
+    ContainerManager manager;
+    WipeOptions quick;
+    quick.policy = WipePolicy::RANDOM_1PASS;
+    manager.setWipeOptions(quick);
+    manager.unlockSession(BENCH_PASSWORD);
+
+    // a real file gives the kdf bench the exact header parameters encryptFile uses
+    std::string probe = dir + "/probe.bin";
+    if (writeRandomFile(probe, 4096) && manager.encryptFile(probe, "probe.sfm", BENCH_PASSWORD)) {
+        benchKdf(getSFMDirectory() + "/probe.sfm", reps);
+        fs::remove(getSFMDirectory() + "/probe.sfm");
+    } else {
+        report({"kdf_scrypt", "probe", 0, 0, 0, false});
+    }
+
+    benchCrypto(manager, dir, maxBytes, reps);
+    benchWipe(manager, dir, std::min<uint64_t>(maxBytes, 256ULL * 1024 * 1024), reps);
+    benchCreate(manager, dir, std::min<uint64_t>(maxBytes, 1024ULL * 1024 * 1024), reps);
+    benchRandomReads(manager, dir, std::min<uint64_t>(maxBytes, 64ULL * 1024 * 1024), 10000, reps);
+    benchComments(manager, dir, 1000, reps);
+
+    // only what the bench created, --dir may be an existing directory
+    fs::remove(probe);
+    fs::remove(dir + "/comment.bin");
+    std::error_code ec;
+    fs::remove(getSFMDirectory(), ec); // left alone if it is not empty
+
+    std::cout.rdbuf(realOut.rdbuf());
+    return failed ? 1 : 0;
+}